@@ -0,0 +1,222 @@
+/*
+Times the conversion kernels in simd_kernels.cpp against the loops they
+replaced in utils.cpp, one row at a time as utils.cpp calls them, and
+checks that every version gives exactly the same output. Run with no
+arguments; returns non-zero if anything didn't match.
+*/
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <functional>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "../include/simd_kernels.h"
+
+// the loops from utils.cpp as they were, one row each
+#define  SCALE  14
+#define  cR  (int)(0.299*(1 << SCALE) + 0.5)
+#define  cG  (int)(0.587*(1 << SCALE) + 0.5)
+#define  cB  ((1 << SCALE) - cR - cG)
+#define  descale(x,n)  (((x) + (1 << ((n)-1))) >> (n))
+
+static void scalarGray8u(const uint8_t * rgb, int cn, uint8_t * gray, int width, bool swap)
+{
+	int swap_rb = swap ? 2 : 0;
+	for (int i = 0; i < width; i++, rgb += cn)
+		gray[i] = (uint8_t)descale(rgb[swap_rb]*cB + rgb[1]*cG + rgb[swap_rb^2]*cR, SCALE);
+}
+
+static void scalarGray16u(const uint16_t * rgb, int cn, uint16_t * gray, int width, bool swap)
+{
+	int swap_rb = swap ? 2 : 0;
+	for (int i = 0; i < width; i++, rgb += cn)
+		gray[i] = (uint16_t)descale(rgb[swap_rb]*cB + rgb[1]*cG + rgb[swap_rb^2]*cR, SCALE);
+}
+
+static void scalarGrayToBGR16u(const uint16_t * gray, uint16_t * bgr, int width)
+{
+	for (int i = 0; i < width; i++, bgr += 3)
+		bgr[0] = bgr[1] = bgr[2] = gray[i];
+}
+
+static void scalarBGRAToBGR16u(const uint16_t * bgra, uint16_t * bgr, int width, bool swap)
+{
+	int swap_rb = swap ? 2 : 0;
+	for (int i = 0; i < width; i++, bgr += 3, bgra += 4)
+	{
+		uint16_t t0 = bgra[swap_rb], t1 = bgra[1];
+		bgr[0] = t0; bgr[1] = t1;
+		t0 = bgra[swap_rb^2]; bgr[2] = t0;
+	}
+}
+
+static void scalarPalette8(const uint8_t * indices, const uint8_t * palette, uint8_t * data, int len)
+{
+	for (int i = 0; i < len; i++)
+		data[i] = palette[indices[i]];
+}
+
+static void scalarPalette4(const uint8_t * indices, const uint8_t * palette, uint8_t * data, int len)
+{
+	uint8_t * end = data + len;
+	while ( (data += 2) < end )
+	{
+		int idx = *indices++;
+		data[-2] = palette[idx >> 4];
+		data[-1] = palette[idx & 15];
+	}
+	int idx = indices[0];
+	data[-2] = palette[idx >> 4];
+	if ( data == end )
+		data[-1] = palette[idx & 15];
+}
+
+static void scalarPalette1(const uint8_t * indices, const uint8_t * palette, uint8_t * data, int len)
+{
+	uint8_t * end = data + len;
+	while ( (data += 8) < end )
+	{
+		int idx = *indices++;
+		for (int b = 0; b < 8; ++b)
+			data[b - 8] = palette[(idx & (128 >> b)) != 0];
+	}
+	int idx = indices[0] << 24;
+	for ( data -= 8; data < end; data++, idx += idx )
+		data[0] = palette[idx < 0];
+}
+
+/*
+A kernel under test: run(width, src, dst) converts one row of width
+pixels, with src and dst big enough for any width up to the frame's
+*/
+struct Kernel
+{
+	std::string name;
+	int srcBytes; // per pixel
+	int dstBytes;
+	std::function<void(int, const uint8_t *, uint8_t *)> scalar;
+	std::function<void(int, const uint8_t *, uint8_t *)> simd;
+};
+
+static const int frameWidth = 512;
+static const int frameHeight = 512;
+
+// ns per pixel for passes over a frame, as many as fit in about 0.2s
+static double timeKernel(const std::function<void(int, const uint8_t *, uint8_t *)> & run, const Kernel & kernel,
+	const std::vector<uint8_t> & src, std::vector<uint8_t> & dst)
+{
+	using clock = std::chrono::steady_clock;
+	long passes = 0;
+	const auto start = clock::now();
+	double elapsed = 0;
+	do
+	{
+		for (int row = 0; row < frameHeight; ++row)
+			run(frameWidth, src.data() + (std::size_t)row * frameWidth * kernel.srcBytes,
+				dst.data() + (std::size_t)row * frameWidth * kernel.dstBytes);
+		++passes;
+		elapsed = std::chrono::duration<double>(clock::now() - start).count();
+	} while ( elapsed < 0.2 );
+	return elapsed * 1e9 / ( (double)passes * frameWidth * frameHeight );
+}
+
+// every width up to 200 and a full row, so all the tails get tried
+static bool matches(const Kernel & kernel, const std::vector<uint8_t> & src)
+{
+	std::vector<uint8_t> expected(frameWidth * kernel.dstBytes + 64), actual(expected.size());
+	for (int width = 1; width <= frameWidth; width = width < 200 ? width + 1 : frameWidth)
+	{
+		std::memset(expected.data(), 0xAA, expected.size());
+		std::memset(actual.data(), 0xAA, actual.size());
+		kernel.scalar(width, src.data(), expected.data());
+		kernel.simd(width, src.data(), actual.data());
+		if ( expected != actual )
+		{
+			std::printf("%s differs from the original at width %d\n", kernel.name.c_str(), width);
+			return false;
+		}
+		if ( width == frameWidth )
+			break;
+	}
+	return true;
+}
+
+int main()
+{
+	uint8_t palette[256];
+	for (int i = 0; i < 256; ++i)
+		palette[i] = (uint8_t)(i * 37 + 11);
+
+	auto u16 = [](const uint8_t * p) { return (const uint16_t*)p; };
+	auto out16 = [](uint8_t * p) { return (uint16_t*)p; };
+	std::vector<Kernel> kernels;
+	for (int cn = 3; cn <= 4; ++cn)
+	{
+		for (int swap = 0; swap < 2; ++swap)
+		{
+			const std::string suffix = std::to_string(cn) + "ch" + ( swap ? " rgb" : "" );
+			kernels.push_back({ "gray 8u " + suffix, cn, 1,
+				[=](int w, const uint8_t * s, uint8_t * d) { scalarGray8u(s, cn, d, w, swap); },
+				[=](int w, const uint8_t * s, uint8_t * d) { bgrToGray8u(s, cn, d, w, swap); } });
+			kernels.push_back({ "gray 16u " + suffix, 2 * cn, 2,
+				[=](int w, const uint8_t * s, uint8_t * d) { scalarGray16u(u16(s), cn, out16(d), w, swap); },
+				[=](int w, const uint8_t * s, uint8_t * d) { bgrToGray16u(u16(s), cn, out16(d), w, swap); } });
+		}
+	}
+	kernels.push_back({ "gray to bgr 16u", 2, 6,
+		[=](int w, const uint8_t * s, uint8_t * d) { scalarGrayToBGR16u(u16(s), out16(d), w); },
+		[=](int w, const uint8_t * s, uint8_t * d) { grayToBGR16u(u16(s), out16(d), w); } });
+	for (int swap = 0; swap < 2; ++swap)
+	{
+		kernels.push_back({ std::string("bgra to bgr 16u") + ( swap ? " rgb" : "" ), 8, 6,
+			[=](int w, const uint8_t * s, uint8_t * d) { scalarBGRAToBGR16u(u16(s), out16(d), w, swap); },
+			[=](int w, const uint8_t * s, uint8_t * d) { bgraToBGR16u(u16(s), out16(d), w, swap); } });
+	}
+	// a byte per pixel is more than enough index for the 4 and 1-bit rows
+	kernels.push_back({ "palette 8-bit", 1, 1,
+		[&](int w, const uint8_t * s, uint8_t * d) { scalarPalette8(s, palette, d, w); },
+		[&](int w, const uint8_t * s, uint8_t * d) { paletteRow8(s, palette, d, w); } });
+	kernels.push_back({ "palette 4-bit", 1, 1,
+		[&](int w, const uint8_t * s, uint8_t * d) { scalarPalette4(s, palette, d, w); },
+		[&](int w, const uint8_t * s, uint8_t * d) { paletteRow4(s, palette, d, w); } });
+	kernels.push_back({ "palette 1-bit", 1, 1,
+		[&](int w, const uint8_t * s, uint8_t * d) { scalarPalette1(s, palette, d, w); },
+		[&](int w, const uint8_t * s, uint8_t * d) { paletteRow1(s, palette, d, w); } });
+
+	std::mt19937 random(12345);
+	const bool avx2 = usingAVX2();
+	std::printf("%-22s %10s %10s %8s", "kernel", "ns/pixel", "SSE2", "speedup");
+	if ( avx2 )
+		std::printf(" %10s %8s", "AVX2", "speedup");
+	std::printf("\n");
+	bool ok = true;
+	for ( auto & kernel : kernels )
+	{
+		// noise over the full range, so the 16-bit sums are tested right up to the top
+		std::vector<uint8_t> src((std::size_t)frameWidth * frameHeight * kernel.srcBytes + 64);
+		for ( auto & b : src )
+			b = (uint8_t)random();
+		// filled so the first version timed doesn't pay for faulting its pages in
+		std::vector<uint8_t> dst((std::size_t)frameWidth * frameHeight * kernel.dstBytes + 64, 0);
+		double avx2Time = 0;
+		if ( avx2 )
+		{
+			ok = matches(kernel, src) && ok;
+			avx2Time = timeKernel(kernel.simd, kernel, src, dst);
+			allowAVX2(false);
+		}
+		ok = matches(kernel, src) && ok;
+		const double sse2Time = timeKernel(kernel.simd, kernel, src, dst);
+		allowAVX2(true);
+		const double scalarTime = timeKernel(kernel.scalar, kernel, src, dst);
+		std::printf("%-22s %10.3f %10.3f %7.1fx", kernel.name.c_str(), scalarTime, sse2Time, scalarTime / sse2Time);
+		if ( avx2 )
+			std::printf(" %10.3f %7.1fx", avx2Time, scalarTime / avx2Time);
+		std::printf("\n");
+	}
+	if ( ! ok )
+		std::printf("Some kernels don't match the original loops\n");
+	return ok ? 0 : 1;
+}
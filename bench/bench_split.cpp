@@ -0,0 +1,282 @@
+/*
+Times the stages of a split on a synthetic ScanImage file (see
+synthetic_tiff.h), or on a real one given with -f: counting and scanning
+the directories, fetching the tags, reading the timestamps and the frames,
+and a whole split into parts. Each is run a few times and the quickest
+kept, so the source is normally in the page cache and these are the speeds
+of the code rather than the disk. MB/s is the size of the source file over
+the time taken, i.e. how quickly a file like it gets through that stage.
+*/
+#include <getopt.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <sstream>
+
+#include <boost/filesystem.hpp>
+
+#include "../include/ScanImageTiff.h"
+#include "../include/split_plan.h"
+#include "../include/split_pipeline.h"
+#include "synthetic_tiff.h"
+
+static void printhelp()
+{
+	std::cout << "\nBenchmarks reading and splitting ScanImage tiffs.\n";
+	std::cout << "Usage:\n";
+	std::cout << "\t-f :  benchmark this file instead of making one up\n";
+	std::cout << "\t-x :  frame width (default 512)\n";
+	std::cout << "\t-y :  frame height (default 512)\n";
+	std::cout << "\t-n :  number of directories (default 1000), can be more than 65535\n";
+	std::cout << "\t-c :  number of interleaved channels (default 1)\n";
+	std::cout << "\t-v :  ScanImage version, 0 (SI5) or 1 (2016 onwards, default)\n";
+	std::cout << "\t-e :  bytes of settings in every frame's header (default 8192)\n";
+	std::cout << "\t-p :  bytes of per-frame lines in every frame's header (default 512)\n";
+	std::cout << "\t-z :  compress the synthetic file with lzw or deflate (default none)\n";
+	std::cout << "\t-s :  frames per part for the split (default 5000)\n";
+	std::cout << "\t-r :  runs of each benchmark, the quickest is reported (default 3)\n";
+	std::cout << "\t-o :  directory for the synthetic file and the split (default the system temp directory)\n";
+	std::cout << "\t-k :  keep the synthetic file afterwards\n";
+	std::cout << "\t-h :  prints this message\n\n";
+	exit(0);
+}
+
+int main(int argc, char **argv)
+{
+	SyntheticTiff spec;
+	std::string inputfile;
+	std::string directory = boost::filesystem::temp_directory_path().string();
+	int chunk_size = 5000;
+	int runs = 3;
+	bool keep = false;
+
+	int c;
+	while (1) {
+		static struct option long_options[] = {
+			{"help", no_argument, 0, 'h'},
+			{"file", required_argument, 0, 'f'},
+			{"width", required_argument, 0, 'x'},
+			{"height", required_argument, 0, 'y'},
+			{"frames", required_argument, 0, 'n'},
+			{"channels", required_argument, 0, 'c'},
+			{"version", required_argument, 0, 'v'},
+			{"header", required_argument, 0, 'e'},
+			{"frame-header", required_argument, 0, 'p'},
+			{"compress", required_argument, 0, 'z'},
+			{"chunks", required_argument, 0, 's'},
+			{"runs", required_argument, 0, 'r'},
+			{"dir", required_argument, 0, 'o'},
+			{"keep", no_argument, 0, 'k'},
+			{0, 0, 0, 0}
+		};
+		int option_index = 0;
+		c = getopt_long(argc, argv, "hf:x:y:n:c:v:e:p:z:s:r:o:k", long_options, &option_index);
+		if ( c == -1 )
+			break;
+		switch (c) {
+			case 'h':
+				printhelp();
+			case 'f':
+				inputfile = optarg;
+				break;
+			case 'x':
+				spec.width = atoi(optarg);
+				break;
+			case 'y':
+				spec.height = atoi(optarg);
+				break;
+			case 'n':
+				spec.frames = strtoul(optarg, nullptr, 10);
+				break;
+			case 'c':
+				spec.channels = atoi(optarg);
+				break;
+			case 'v':
+				spec.version = atoi(optarg);
+				if ( spec.version != 0 && spec.version != 1 ) {
+					std::cout << "The ScanImage version is 0 or 1, so exiting\n";
+					exit(1);
+				}
+				break;
+			case 'e':
+				spec.headerBytes = strtoul(optarg, nullptr, 10);
+				break;
+			case 'p':
+				spec.frameHeaderBytes = strtoul(optarg, nullptr, 10);
+				break;
+			case 'z':
+				if ( strcmp(optarg, "none") == 0 )
+					spec.compression = COMPRESSION_NONE;
+				else if ( strcmp(optarg, "lzw") == 0 )
+					spec.compression = COMPRESSION_LZW;
+				else if ( strcmp(optarg, "deflate") == 0 || strcmp(optarg, "zip") == 0 )
+					spec.compression = COMPRESSION_ADOBE_DEFLATE;
+				else {
+					std::cout << "Unknown compression " << optarg << ", so exiting\n";
+					exit(1);
+				}
+				break;
+			case 's':
+				chunk_size = atoi(optarg);
+				break;
+			case 'r':
+				runs = std::max(1, atoi(optarg));
+				break;
+			case 'o':
+				directory = optarg;
+				break;
+			case 'k':
+				keep = true;
+				break;
+			default:
+				abort();
+		}
+	}
+
+	// the results go to stdout, what the reader and the split say as they go is dropped
+	std::ostream out(std::cout.rdbuf());
+	std::ostringstream chatter;
+	std::cout.rdbuf(chatter.rdbuf());
+	// and std::cout has to be given its own back before chatter goes
+	auto restoreCout = [&]() { std::cout.rdbuf(out.rdbuf()); };
+	auto fail = [&](const std::string & message) {
+		restoreCout();
+		out << message << std::endl;
+		exit(1);
+	};
+
+	using clock = std::chrono::steady_clock;
+	auto seconds = [](clock::time_point start) { return std::chrono::duration<double>(clock::now() - start).count(); };
+	const std::string base = ( boost::filesystem::path(directory) / ( "bench_split_" + std::to_string(getpid()) ) ).string();
+	uint64 filesize;
+	bool generated = inputfile.empty();
+	char line[160];
+	if ( generated )
+	{
+		inputfile = base + ".tif";
+		const char * compression = spec.compression == COMPRESSION_LZW ? "lzw" :
+			spec.compression == COMPRESSION_ADOBE_DEFLATE ? "deflate" : "no";
+		out << "ScanImage version " << spec.version << ", " << spec.frames << " directories of " << spec.width << "x"
+			<< spec.height << ", " << spec.channels << " channel(s), " << spec.headerBytes << " + " << spec.frameHeaderBytes
+			<< " header bytes, " << compression << " compression" << std::endl;
+		const auto start = clock::now();
+		filesize = writeSyntheticTiff(inputfile, spec);
+		if ( filesize == 0 )
+			fail("Could not write " + inputfile);
+		const double t = seconds(start);
+		snprintf(line, sizeof(line), "%-20s %10.3f %12.1f %10.1f", "generate", t, spec.frames / t, filesize / t / (1 << 20));
+		out << inputfile << ", " << filesize << " bytes\n\n";
+		out << "benchmark               seconds     frames/s       MB/s\n" << line << std::endl;
+	}
+	else
+	{
+		boost::system::error_code error;
+		filesize = boost::filesystem::file_size(inputfile, error);
+		if ( error )
+			fail("Could not open " + inputfile);
+		out << inputfile << ", " << filesize << " bytes\n\n";
+		out << "benchmark               seconds     frames/s       MB/s" << std::endl;
+	}
+
+	// a fresh reader for every run, as the reader remembers where it got to
+	auto openReader = [&]() {
+		std::unique_ptr<SITiffReader> reader(new SITiffReader(inputfile));
+		if ( ! reader->open() )
+			fail("Could not open " + inputfile);
+		return reader;
+	};
+	std::vector<DirInfo> dirs;
+	{
+		auto reader = openReader();
+		reader->scanDirectories(dirs);
+	}
+	const unsigned int ndirs = dirs.size();
+	if ( ndirs == 0 )
+		fail("There are no directories in " + inputfile);
+
+	/*
+	Runs prepare then work, timing only the work, as many times as asked
+	and reports the quickest. frames is how many the work got through
+	*/
+	auto bench = [&](const char * name, std::function<void()> prepare, std::function<unsigned int()> work) {
+		double best = 0;
+		unsigned int frames = 0;
+		for (int run = 0; run < runs; ++run)
+		{
+			prepare();
+			const auto start = clock::now();
+			frames = work();
+			const double t = seconds(start);
+			if ( run == 0 || t < best )
+				best = t;
+			chatter.str("");
+		}
+		snprintf(line, sizeof(line), "%-20s %10.3f %12.1f %10.1f", name, best, frames / best, filesize / best / (1 << 20));
+		out << line << std::endl;
+	};
+
+	std::unique_ptr<SITiffReader> reader;
+	auto reopen = [&]() { reader = openReader(); };
+
+	bench("countDirectories", reopen, [&]() {
+		int count = 0;
+		reader->countDirectories(count);
+		return (unsigned int)count;
+	});
+	bench("scanDirectories", reopen, [&]() {
+		std::vector<DirInfo> scanned;
+		return (unsigned int)reader->scanDirectories(scanned);
+	});
+	bench("readTags", reopen, [&]() {
+		std::string sw, imdesc;
+		for (unsigned int i = 0; i < ndirs; ++i)
+			if ( ! reader->readTags(i, sw, imdesc) )
+				fail("Failed to read the tags of directory " + std::to_string(i));
+		return ndirs;
+	});
+	bench("getAllTimeStamps", reopen, [&]() {
+		reader->getAllTimeStamps();
+		return ndirs;
+	});
+	bench("readframe", reopen, [&]() {
+		cv::Mat frame;
+		for (unsigned int i = 0; i < ndirs; ++i)
+			if ( ! reader->readframe(frame, i) )
+				fail("Failed to read frame " + std::to_string(i));
+		return ndirs;
+	});
+	// planned as TiffSplitter -c does, and written next to the source
+	std::unique_ptr<SplitPlan> plan;
+	// the parts of the last run go before the next, outside the timing
+	auto removeParts = [&]() {
+		if ( plan )
+			for (int p = 0; p < plan->numParts(); ++p)
+				unlink(plan->getPart(p).filename.c_str());
+	};
+	bench("split", [&]() {
+		removeParts();
+		reopen();
+		plan.reset(new SplitPlan(base + "_out"));
+		if ( ! plan->byFrames(dirs, chunk_size) )
+			fail("Could not plan the split");
+	}, [&]() {
+		SplitPipeline pipeline(reader.get(), plan.get());
+		if ( ! pipeline.run() )
+			fail("The split failed: " + chatter.str());
+		return (unsigned int)pipeline.getFramesWritten();
+	});
+	removeParts();
+
+	reader.reset();
+	restoreCout();
+	if ( generated && ! keep )
+		unlink(inputfile.c_str());
+	return 0;
+}
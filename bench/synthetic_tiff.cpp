@@ -0,0 +1,173 @@
+#include "synthetic_tiff.h"
+
+#include <sys/stat.h>
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <vector>
+
+// distinct frames of noise, cycled through, so writing doesn't wait on making them
+static const int noiseFrames = 16;
+
+static std::string timestamp(double t)
+{
+	char buf[32];
+	snprintf(buf, sizeof(buf), "%.6f", t);
+	return buf;
+}
+
+// spec.channels saved channels as ScanImage lists them, e.g. [1;2]
+static std::string savedChannels(int channels)
+{
+	std::string list;
+	for (int c = 1; c <= channels; ++c)
+		list += ( c > 1 ? ";" : "" ) + std::to_string(c);
+	return channels > 1 ? "[" + list + "]" : list;
+}
+
+static void padTo(std::string & text, unsigned int bytes, const std::string & prefix)
+{
+	for (int n = 0; text.size() + prefix.size() + 16 < bytes; ++n)
+		text += prefix + std::to_string(n) + " = " + std::to_string(n * 37 % 1000) + "\n";
+}
+
+// the settings, the same for every frame
+static std::string settings(const SyntheticTiff & spec)
+{
+	std::string s;
+	std::string luts, offsets, names;
+	for (int c = 1; c <= spec.channels; ++c)
+	{
+		luts += std::string(c > 1 ? " " : "") + "[-50 " + std::to_string(200 + 100 * c) + "]";
+		offsets += std::string(c > 1 ? " " : "") + std::to_string(-30 - c);
+		names += std::string(c > 1 ? " " : "") + "'Channel " + std::to_string(c) + "'";
+	}
+	if ( spec.version == 0 )
+	{
+		s += "scanimage.SI5.VERSION_MAJOR = 5\n";
+		s += "scanimage.SI5.channelsSave = " + savedChannels(spec.channels) + "\n";
+		for (int c = 1; c <= spec.channels; ++c)
+			s += "scanimage.SI5.chan" + std::to_string(c) + "LUT = [-50 " + std::to_string(200 + 100 * c) + "]\n";
+		s += "scanimage.SI5.channelOffsets = [" + offsets + "]\n";
+		s += "scanimage.SI5.stackNumSlices = 1\n";
+		s += "scanimage.SI5.fastZEnable = 0\n";
+		s += "scanimage.SI5.linesPerFrame = " + std::to_string(spec.height) + "\n";
+		s += "scanimage.SI5.pixelsPerLine = " + std::to_string(spec.width) + "\n";
+		s += "scanimage.SI5.scanFrameRate = " + std::to_string(spec.frameRate) + "\n";
+		padTo(s, spec.headerBytes, "scanimage.SI5.setting");
+	}
+	else
+	{
+		s += "SI.LINE_FORMAT_VERSION = 1\n";
+		s += "SI.VERSION_MAJOR = '2016b'\n";
+		s += "SI.VERSION_MINOR = '0'\n";
+		s += "SI.hChannels.channelSave = " + savedChannels(spec.channels) + "\n";
+		s += "SI.hChannels.channelLUT = {" + luts + "}\n";
+		s += "SI.hChannels.channelOffset = [" + offsets + "]\n";
+		s += "SI.hChannels.channelName = {" + names + "}\n";
+		s += "SI.hFastZ.enable = false\n";
+		s += "SI.hStackManager.numSlices = 1\n";
+		s += "SI.hRoiManager.linesPerFrame = " + std::to_string(spec.height) + "\n";
+		s += "SI.hRoiManager.pixelsPerLine = " + std::to_string(spec.width) + "\n";
+		s += "SI.hRoiManager.scanFrameRate = " + std::to_string(spec.frameRate) + "\n";
+		padTo(s, spec.headerBytes, "SI.hScan2D.setting");
+	}
+	return s;
+}
+
+// the lines that change from frame to frame
+static std::string frameLines(const SyntheticTiff & spec, unsigned int dir)
+{
+	const unsigned int frame = dir / spec.channels + 1;
+	const std::string t = timestamp(( frame - 1 ) / spec.frameRate);
+	std::string s;
+	if ( spec.version == 0 )
+	{
+		s += "Frame Number = " + std::to_string(frame) + "\n";
+		s += "Frame Timestamp(s) = " + t + "\n";
+		s += "Acq Trigger Timestamp(s) = 0.000000\n";
+		padTo(s, spec.frameHeaderBytes, "Aux Trigger ");
+	}
+	else
+	{
+		s += "frameNumbers = " + std::to_string(frame) + "\n";
+		s += "frameNumberAcquisition = " + std::to_string(frame) + "\n";
+		s += "frameTimestamps_sec = " + t + "\n";
+		s += "acqTriggerTimestamps_sec = \n";
+		s += "nextFileMarkerTimestamps_sec = \n";
+		s += "endOfAcquisition = " + std::string(dir + 1 == spec.frames ? "1" : "0") + "\n";
+		s += "endOfAcquisitionMode = 0\n";
+		s += "dcOverVoltage = 0\n";
+		s += "epoch = [2016 11 3 14 2 " + t + "]\n";
+		padTo(s, spec.frameHeaderBytes, "auxTrigger");
+		s += "I2CData = {}\n";
+	}
+	return s;
+}
+
+uint64 writeSyntheticTiff(const std::string & filename, const SyntheticTiff & spec)
+{
+	if ( spec.width < 1 || spec.height < 1 || spec.channels < 1 || spec.frames < 1 )
+		return 0;
+	// pixels plus both headers, with some to spare for the IFDs
+	const uint64 estimate = (uint64)spec.frames * ( (uint64)spec.width * spec.height * 2 + spec.headerBytes +
+		spec.frameHeaderBytes + 512 );
+	const bool bigtiff = spec.bigtiff || estimate > 0xF0000000ULL;
+	TIFF * tif = TIFFOpen(filename.c_str(), bigtiff ? "w8" : "w");
+	if ( ! tif )
+		return 0;
+
+	// a few bright blobs on a dim background (about the channel offset), plus shot-ish noise
+	const std::size_t npixels = (std::size_t)spec.width * spec.height;
+	std::vector<double> background(npixels);
+	for (int y = 0; y < spec.height; ++y)
+		for (int x = 0; x < spec.width; ++x)
+		{
+			double v = 0;
+			for (int b = 0; b < 6; ++b)
+			{
+				const double cx = spec.width * ( 0.15 + 0.14 * b ), cy = spec.height * ( 0.2 + 0.12 * ( b % 4 ) );
+				const double r = std::max(spec.width, spec.height) * 0.08;
+				v += 800 * std::exp(-( ( x - cx ) * ( x - cx ) + ( y - cy ) * ( y - cy ) ) / ( 2 * r * r ));
+			}
+			background[(std::size_t)y * spec.width + x] = v - 30;
+		}
+	std::vector<std::vector<int16>> noise(noiseFrames, std::vector<int16>(npixels));
+	uint32 seed = 12345;
+	for ( auto & frame : noise )
+		for (std::size_t i = 0; i < npixels; ++i)
+		{
+			seed = seed * 1664525u + 1013904223u;
+			const int n = (int)( seed >> 24 ) - 128; // -128..127
+			frame[i] = (int16)std::lround(background[i] + n * ( 0.1 + std::sqrt(std::max(0.0, background[i] + 30)) / 16 ));
+		}
+
+	const std::string sw = settings(spec);
+	bool ok = true;
+	for (unsigned int dir = 0; dir < spec.frames && ok; ++dir)
+	{
+		std::string desc = frameLines(spec, dir);
+		if ( spec.version == 0 )
+			desc += sw;
+		TIFFSetField(tif, TIFFTAG_IMAGEWIDTH, (uint32)spec.width);
+		TIFFSetField(tif, TIFFTAG_IMAGELENGTH, (uint32)spec.height);
+		TIFFSetField(tif, TIFFTAG_BITSPERSAMPLE, 16);
+		TIFFSetField(tif, TIFFTAG_SAMPLESPERPIXEL, 1);
+		TIFFSetField(tif, TIFFTAG_SAMPLEFORMAT, SAMPLEFORMAT_INT);
+		TIFFSetField(tif, TIFFTAG_PHOTOMETRIC, PHOTOMETRIC_MINISBLACK);
+		TIFFSetField(tif, TIFFTAG_PLANARCONFIG, PLANARCONFIG_CONTIG);
+		TIFFSetField(tif, TIFFTAG_COMPRESSION, spec.compression);
+		// ScanImage writes a frame as a single strip
+		TIFFSetField(tif, TIFFTAG_ROWSPERSTRIP, (uint32)spec.height);
+		TIFFSetField(tif, TIFFTAG_IMAGEDESCRIPTION, desc.c_str());
+		if ( spec.version != 0 )
+			TIFFSetField(tif, TIFFTAG_SOFTWARE, sw.c_str());
+		std::vector<int16> & pixels = noise[( dir / spec.channels + dir % spec.channels * 7 ) % noiseFrames];
+		ok = TIFFWriteEncodedStrip(tif, 0, pixels.data(), npixels * 2) >= 0 && TIFFWriteDirectory(tif) == 1;
+	}
+	TIFFClose(tif);
+	struct stat st;
+	if ( ! ok || stat(filename.c_str(), &st) != 0 )
+		return 0;
+	return st.st_size;
+}
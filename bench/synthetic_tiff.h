@@ -0,0 +1,43 @@
+#ifndef SYNTHETIC_TIFF_H_
+#define SYNTHETIC_TIFF_H_
+
+#include <string>
+
+#include <tiffio.h>
+
+/*
+What a made-up ScanImage recording looks like. Version 1 files are laid
+out like ScanImage 2016 onwards: the acquisition's settings (SI.* = ...)
+are repeated in the Software tag of every frame, and each frame's
+ImageDescription has its frame number, timestamp, trigger times and so on.
+Version 0 files are like ScanImage 5, with no Software tag and the frame
+lines followed by the settings (scanimage.SI5.* = ...) all in the
+ImageDescription.
+
+headerBytes is roughly how big the settings get and frameHeaderBytes the
+per-frame lines, both padded out with more settings or aux trigger lines
+the way the real ones are. Real recordings have anything from a few KB of
+settings to tens of KB.
+*/
+struct SyntheticTiff
+{
+	int width = 512;
+	int height = 512;
+	unsigned int frames = 1000; // directories, so frames of each channel times the channels
+	int channels = 1; // saved channels, interleaved frame by frame
+	int version = 1; // 0 or 1, as in SITiffHeader::versionCheck
+	unsigned int headerBytes = 8 << 10;
+	unsigned int frameHeaderBytes = 512;
+	int compression = COMPRESSION_NONE;
+	double frameRate = 30; // Hz, for the timestamps
+	bool bigtiff = false; // written as a BigTIFF anyway if it wouldn't fit in a classic tiff
+};
+
+/*
+Writes it out with libtiff as int16 frames of noise on a smooth background
+so it compresses about as well as a real one. Returns the file's size, 0
+if it couldn't be written
+*/
+uint64 writeSyntheticTiff(const std::string & filename, const SyntheticTiff & spec);
+
+#endif
@@ -5,6 +5,7 @@
 #include <iostream>
 #include <string>
 #include <map>
+#include <functional>
 
 #include <opencv2/core.hpp>
 #include <opencv2/opencv.hpp>
@@ -14,6 +15,16 @@
 #include <opencv2/core/utility.hpp>
 
 #include "utils.hpp"
+
+/*
+Before libtiff 4.5 directory numbers were 16 bits, so TIFFReadDirectory
+gave up after 65535 directories (and longer recordings were quietly cut
+short), and every TIFFWriteDirectory walked the whole IFD chain from the
+header, which the stream and O_DIRECT sinks in tiff_io.h can't afford
+*/
+#if TIFFLIB_VERSION < 20221213
+#error "libtiff 4.5 or later is needed"
+#endif
 #include <vector>
 #include <sstream>
 // Some string utilities
@@ -36,8 +47,62 @@ inline std::vector<std::string> split(const std::string &s, char delim)
 	return elems;
 }
 
+// Replaces whatever follows key on its line (e.g. the value of a ScanImage
+// header entry "key = value") with value; false if key isn't there
+inline bool replaceValue(std::string &s, const std::string &key, const std::string &value)
+{
+	std::size_t start = s.find(key);
+	if ( start == std::string::npos )
+		return false;
+	start += key.length();
+	std::size_t end = s.find('\n', start);
+	if ( end == std::string::npos )
+		end = s.length();
+	s.replace(start, end - start, " " + value);
+	return true;
+}
+
 class SITiffReader;
 
+/*
+What a single directory (frame) looks like, gathered by walking the IFDs
+without touching any pixel data - enough to plan how a file will be
+split before any of it is written
+*/
+struct DirInfo
+{
+	uint32 width = 0;
+	uint32 height = 0;
+	uint16 bitsPerSample = 16;
+	uint16 samplesPerPixel = 1;
+	uint16 compression = 1;
+	uint64 stripBytes = 0; // sum of the StripByteCounts
+	uint32 imDescLen = 0; // string lengths of the ImageDescription...
+	uint32 swLen = 0; // ...and Software tags as they'll be written out
+	std::size_t imDescHash = 0; // hashes of the same so repeated values can
+	std::size_t swHash = 0; // be spotted (see TiffWriter::setShareTags)
+};
+
+/*
+How to bring the raw values of a channel into display range: base (the
+channel offset plus the bottom of its LUT window) is subtracted and the
+result multiplied by scale, which stretches the LUT window over the whole
+range of the output type
+*/
+struct ChannelScaling
+{
+	int base = 0;
+	float scale = 1;
+};
+
+// Timing scraped from the ImageDescription of a single frame
+struct FrameTimes
+{
+	double timestamp = -1; // frameTimestamps_sec, -1 if it's missing
+	std::string acqTriggers; // acqTriggerTimestamps_sec, as written
+	std::string nextFileMarkers; // nextFileMarkerTimestamps_sec, as written
+};
+
 class SITiffHeader
 {
 public:
@@ -88,6 +153,12 @@ public:
 	std::map<int, std::pair<int, int>> getChanLut() { return chanLUT; }
 	std::map<int, int> getChanOffsets() { return chanOffs; }
 	std::map<int, int> getChanSaved() { return chanSaved; }
+	/*
+	Number of z-planes interleaved in directory order, i.e. the frames per
+	volume of a fast-z acquisition. 1 for anything else (a slow stack
+	writes its slices one after the other so they don't interleave)
+	*/
+	int getNumPlanes() { return numPlanes; }
 	friend std::ostream & operator << (std::ostream & stream, const SITiffHeader & header)
 	{
 		stream << header.m_swTag;
@@ -98,8 +169,27 @@ public:
 	unsigned int getSizePerDir(TIFF * m_tif, unsigned int dirnum=0);
 	std::vector<double> getTimeStamps() { return m_timestamps; }
 	int countDirectories(TIFF *, int &);
+	// Walks all the directories filling out a DirInfo for each; returns the count
+	int scanDirectories(TIFF *, std::vector<DirInfo> &);
+	/*
+	Pulls the timestamp and the trigger times out of an ImageDescription
+	tag that's already been read (e.g. by SITiffReader::readTags) so the
+	timing can be followed while the file is being copied rather than in
+	a separate pass. False if there's no timestamp or it isn't a number
+	*/
+	bool parseFrameTimes(const std::string & imdesc, FrameTimes & times);
 	const std::string getFrameNumberString() { return frameString; }
 	const std::string getFrameTimeStampString() { return frameTimeStamp; }
+	const std::string getLinesPerFrameString() { return linesPerFrame; }
+	const std::string getPixelsPerLineString() { return pixelsPerLine; }
+	/*
+	Moves the tif file to directory dirnum. TIFFSetDirectory re-reads the
+	directory even if it's the current one (and older versions of libtiff
+	walk the chain from the start of the file to find it) so check where
+	we are first and, when reading through the file in order, just step
+	on with TIFFReadDirectory
+	*/
+	bool gotoDirectory(TIFF * m_tif, unsigned int dirnum);
 
 private:
 	SITiffReader * m_parent;
@@ -113,6 +203,7 @@ private:
 	void parseChannelLUT(std::string); // fills out chanLUT map (see below)
 	void parseChannelOffsets(std::string); // fills out chanOffs map (see below)
 	void parseSavedChannels(std::string savedchans); // fills out chanSaved map (see below)
+	void parseStack(const std::string & source); // sets numPlanes (see below)
 
 	// Member variables
 	// target key strings to grab from the tiff header (using grabStr)
@@ -121,8 +212,16 @@ private:
 	std::string channelLUT;
 	std::string channelOffsets;
 	std::string channelNames;
+	std::string numSlices;
+	std::string fastZEnable;
+	std::string fastZFlyback;
+	std::string fastZDiscardFlyback;
 	std::string frameString;
 	std::string frameTimeStamp;
+	std::string linesPerFrame;
+	std::string pixelsPerLine;
+	std::string acqTriggerTimeStamps;
+	std::string nextFileMarkerTimeStamps;
 
 	// Filled out in scrapeHeaders
 	std::vector<double> m_timestamps;
@@ -147,6 +246,11 @@ private:
 	the map is 1-indexed for both members
 	*/
 	std::map<int, int> chanSaved;
+	/*
+	Frames per fast-z volume: numSlices, plus the flyback frames if they
+	weren't discarded. Channels are interleaved within each plane
+	*/
+	int numPlanes = 1;
 };
 
 class SITiffReader
@@ -158,7 +262,31 @@ public:
 	bool isOpen() { return isopened; }
 	bool readheader();
 	cv::Mat readframe(int framedir=0);
-	// bool readframe(cv::OutputArray);
+	/*
+	As above but decodes into 'frame', which is only (re)allocated if it
+	isn't already the right size and type - lets the split pipeline
+	recycle its frame buffers
+	*/
+	bool readframe(cv::Mat & frame, int framedir);
+	/*
+	Decodes just the part of directory framedir inside region (clipped to
+	the image) into frame. Only the strips or tiles that overlap the region
+	are read and decompressed so a narrow crop costs a fraction of a whole
+	frame. False if the region misses the image entirely
+	*/
+	bool readRegion(cv::Mat & frame, const cv::Rect & region, int framedir);
+	/*
+	Sets the image size ScanImage recorded in a header (the Software tag,
+	or the ImageDescription for version 0 files) for frames that have been
+	cropped or resized; tags without the size are left alone
+	*/
+	void setImageSizeTags(std::string & tag, int height, int width);
+	/*
+	Grabs the Software and ImageDescription tags for directory dirnum
+	without parsing them. For version 0 files the Software tag is
+	empty so the ImageDescription is returned for both (same as getSWTag)
+	*/
+	bool readTags(int dirnum, std::string & swTag, std::string & imDescTag);
 	bool close();
 	bool release();
 	int getVersion() { return headerdata->getVersion(); }
@@ -174,10 +302,32 @@ public:
 	*/
 	int scrapeHeaders(int & count) { return headerdata->scrapeHeaders(m_tif, count); }
 	int countDirectories(int & count) { return headerdata->countDirectories(m_tif, count); }
+	int scanDirectories(std::vector<DirInfo> & dirs) { return headerdata->scanDirectories(m_tif, dirs); }
 	unsigned int getSizePerDir(int dirnum=0) { return headerdata->getSizePerDir(m_tif, dirnum); }
 	std::map<int, std::pair<int, int>> getChanLut() { return headerdata->getChanLut(); }
 	std::map<int, int> getSavedChans() { return headerdata->getChanSaved(); }
 	std::map<int, int> getChanOffsets() { return headerdata->getChanOffsets(); }
+	int getNumPlanes() { return headerdata->getNumPlanes(); }
+	// the (saved) channel number of directory dirnum as the channels are interleaved
+	int getChannelFor(int dirnum);
+	/*
+	Scaling for channel chan (1-based, as in getChanOffsets) into depth,
+	CV_8U or CV_16U, from the channel offset and LUT in the header (so
+	readheader has to have been called). A channel without a LUT just has
+	the offset taken off
+	*/
+	ChannelScaling getChannelScaling(int chan, int depth);
+	/*
+	Converts a CV_16SC1 frame to CV_8UC1 or CV_16UC1 (depth) with scaling,
+	saturating anything outside the window. dst is only reallocated if it
+	isn't already the right size and type. The second version works out the
+	channel and scaling from the directory the frame came from
+	*/
+	static bool convertFrame(const cv::Mat & src, cv::Mat & dst, const ChannelScaling & scaling, int depth);
+	bool convertFrame(const cv::Mat & src, cv::Mat & dst, int dirnum, int depth);
+	bool parseFrameTimes(const std::string & imDescTag, FrameTimes & times) { return headerdata->parseFrameTimes(imDescTag, times); }
+	// the key of the per-frame timestamp in the ImageDescription, which differs between versions
+	const std::string getFrameTimeStampString() { return headerdata->getFrameTimeStampString(); }
 
 	void getFrameNumAndTimeStamp(const unsigned int, unsigned int &, double &);
 
@@ -44,6 +44,7 @@
 #define _BITSTRM_H_
 
 #include <stdio.h>
+#include <stdint.h>
 #include <cassert>
 #include <opencv2/opencv.hpp>
 namespace cv
@@ -60,6 +61,9 @@ enum
 typedef unsigned long ulong;
 
 // class RBaseStream - base class for other reading streams.
+// Positions are 64-bit so a stream can go right through a BigTIFF file. A file is
+// read a block at a time with pread, or mapped into memory whole by openMapped,
+// after which reading it is the same as reading a buffer
 class RBaseStream
 {
 public:
@@ -69,11 +73,15 @@ public:
 
     virtual bool  open( const cv::String& filename );
     virtual bool  open( const cv::Mat& buf );
+    // false if the file can't be mapped (it's empty, or too big for the address space)
+    virtual bool  openMapped( const cv::String& filename );
     virtual void  close();
     bool          isOpened();
-    void          setPos( int pos );
-    int           getPos();
-    void          skip( int bytes );
+    // bytes read from a file at a time; only while the stream isn't open
+    void          setBlockSize( int size );
+    void          setPos( int64_t pos );
+    int64_t       getPos();
+    void          skip( int64_t bytes );
 
 protected:
 
@@ -81,9 +89,10 @@ protected:
     uchar*  m_start;
     uchar*  m_end;
     uchar*  m_current;
-    FILE*   m_file;
+    int     m_fd;
+    size_t  m_map_size; // non-zero if m_start is a mapping of the file
     int     m_block_size;
-    int     m_block_pos;
+    int64_t m_block_pos;
     bool    m_is_opened;
 
     virtual void  readBlock();
@@ -103,6 +112,8 @@ public:
     int     getBytes( void* buffer, int count );
     int     getWord();
     int     getDWord();
+    // BigTIFF offsets and counts
+    uint64_t getQWord();
 };
 
 // class RMBitStream - uchar-oriented stream.
@@ -114,6 +125,7 @@ public:
 
     int     getWord();
     int     getDWord();
+    uint64_t getQWord();
 };
 
 // WBaseStream - base class for output streams
@@ -128,7 +140,9 @@ public:
     virtual bool  open( std::vector<uchar>& buf );
     virtual void  close();
     bool          isOpened();
-    int           getPos();
+    // bytes buffered before each write; only while the stream isn't open
+    void          setBlockSize( int size );
+    int64_t       getPos();
 
 protected:
 
@@ -136,7 +150,7 @@ protected:
     uchar*  m_end;
     uchar*  m_current;
     int     m_block_size;
-    int     m_block_pos;
+    int64_t m_block_pos;
     FILE*   m_file;
     bool    m_is_opened;
     std::vector<uchar>* m_buf;
@@ -158,6 +172,7 @@ public:
     void  putBytes( const void* buffer, int count );
     void  putWord( int val );
     void  putDWord( int val );
+    void  putQWord( uint64_t val );
 };
 
 
@@ -169,6 +184,7 @@ public:
     virtual ~WMByteStream();
     void  putWord( int val );
     void  putDWord( int val );
+    void  putQWord( uint64_t val );
 };
 
 inline unsigned BSWAP(unsigned v)
@@ -0,0 +1,24 @@
+#ifndef CRC32C_H_
+#define CRC32C_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+/*
+CRC-32C (the Castagnoli polynomial, as used by iSCSI, ext4 and friends)
+for checksumming frames as they're written. On x86 CPUs with SSE4.2 it's
+worked out with the crc32 instruction, 8 bytes at a time, which is fast
+enough to run alongside the writer without slowing it down; anything else
+uses a slicing-by-8 table. Both give the same answer.
+
+Pass 0 to start and the previous result to carry on, so checksumming a
+buffer in pieces gives the same as doing it in one go
+*/
+uint32_t crc32c(uint32_t crc, const void * data, std::size_t len);
+// as 8 lower case hex digits
+std::string crc32cHex(uint32_t crc);
+// true if the SSE4.2 instruction is being used
+bool usingCRC32CInstruction();
+
+#endif
@@ -0,0 +1,215 @@
+#ifndef FRAME_TRANSFORMS_H_
+#define FRAME_TRANSFORMS_H_
+
+#include <atomic>
+#include <deque>
+#include <fstream>
+#include <map>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include <opencv2/core.hpp>
+
+#include "ScanImageTiff.h"
+#include "split_pipeline.h"
+
+/*
+Averages every 'frames' consecutive frames of each channel and plane of
+each output stream into one (temporal binning), e.g. to cut down the size
+of a long, oversampled recording. ScanImage interleaves the channels and
+fast-z planes, so each of them is binned separately (see SplitPlan::binFor)
+and the averaged frames come out interleaved the same way. The first
+packet of a bin carries the result: it's held back
+while the rest of the bin is summed into a 32-bit accumulator (those
+packets are marked as skipped) and is released with the average once the
+bin is full, keeping its own headers but with frameTimestamps_sec replaced
+by the mean timestamp of the bin. A bin is also cut short at the end of a
+part and at the end of the file, in which case it's the average of
+whatever frames it got. Only CV_16SC1 frames are binned; anything else is
+passed straight through.
+
+The SplitPlan has to be told about the binning too (see
+SplitPlan::setTemporalBin) so the parts are sized for the binned output.
+*/
+class TemporalBinning : public FrameTransform
+{
+public:
+	TemporalBinning(SITiffReader * reader, const SplitPlan * plan, unsigned int frames);
+	void process(FramePacket * packet, std::vector<FramePacket*> & out);
+	void flush(std::vector<FramePacket*> & out);
+	// one carrier per bin
+	unsigned int maxHeld() { return m_bins.size(); }
+
+private:
+	struct Bin
+	{
+		FramePacket * carrier = nullptr;
+		cv::Mat sum; // CV_32SC1
+		unsigned int count = 0;
+		double timeSum = 0;
+		unsigned int timeCount = 0;
+	};
+	void add(Bin & bin, FramePacket * packet);
+	// write the average into the carrier and send it on
+	void release(Bin & bin, std::vector<FramePacket*> & out);
+
+	SITiffReader * m_reader;
+	const SplitPlan * m_plan;
+	unsigned int m_frames;
+	std::vector<Bin> m_bins; // see SplitPlan::binFor
+};
+
+/*
+Bins each frame 2x2 or 4x4 (the mean of each block, rounded) for smaller
+quick-look output. Any rows or columns left over at the right and bottom
+edges are dropped. The image size ScanImage records in the headers
+(linesPerFrame and pixelsPerLine) is changed to match; the tiff's own
+size tags follow from the frame itself. As with TemporalBinning only
+CV_16SC1 frames are binned and SplitPlan::setSpatialBin needs to be set
+to match.
+*/
+class SpatialBinning : public FrameTransform
+{
+public:
+	SpatialBinning(SITiffReader * reader, int factor);
+	void process(FramePacket * packet, std::vector<FramePacket*> & out);
+
+private:
+	SITiffReader * m_reader;
+	int m_factor;
+	// the binned frames go in a buffer kept for each packet so nothing is reallocated
+	std::map<FramePacket*, cv::Mat> m_binned;
+};
+
+/*
+Converts each CV_16SC1 frame to 8 or 16-bit unsigned (CV_8U / CV_16U) for
+viewing: the offset of the frame's channel is subtracted, the channel's
+LUT window stretched over the output range and anything outside it
+saturated (see SITiffReader::getChannelScaling). Frames are matched to
+channels by directory number as ScanImage interleaves them, so this works
+with or without deinterleaving. Set SplitPlan::setBitsPerSample to match.
+*/
+class DisplayConversion : public FrameTransform
+{
+public:
+	// reader->readheader() has to have been called for the offsets and LUTs
+	DisplayConversion(SITiffReader * reader, int depth);
+	void process(FramePacket * packet, std::vector<FramePacket*> & out);
+
+private:
+	SITiffReader * m_reader;
+	int m_depth;
+	std::map<int, ChannelScaling> m_scaling; // by channel
+	std::map<FramePacket*, cv::Mat> m_converted;
+};
+
+/*
+Works out mean, maximum and standard deviation projections of every part
+as it goes past, saving a second read of each part just for QC. They're
+written as 32-bit float tiffs next to the part when its last frame has
+gone by, named like base_part0_mean.tif, _max.tif and _std.tif.
+
+The accumulating is spread over a few worker threads. Frames are handed
+out to them in turn and each worker keeps its own partial sums for each
+part, which are merged when the part ends. Frames are held back, in
+order, until their worker has finished with them. Only CV_16SC1 frames
+are counted so these are projections of the raw values - add this before
+a DisplayConversion.
+*/
+class Projections : public FrameTransform
+{
+public:
+	Projections(unsigned int threads = 2);
+	~Projections();
+	void process(FramePacket * packet, std::vector<FramePacket*> & out);
+	void flush(std::vector<FramePacket*> & out);
+	unsigned int maxHeld() { return m_maxHeld; }
+	unsigned int getPartsProjected() { return m_projected; }
+
+private:
+	struct Accumulator
+	{
+		cv::Mat sum, sumsq; // CV_64FC1
+		cv::Mat max; // CV_16SC1
+		unsigned int count = 0;
+		void add(const cv::Mat & frame);
+		void merge(const Accumulator & other);
+	};
+	struct Worker
+	{
+		std::unique_ptr<SPSCQueue<FramePacket*>> jobs; // nullptr to stop
+		std::atomic<uint64> done{0}; // number of jobs finished
+		uint64 submitted = 0;
+		std::map<int, Accumulator> parts; // partial sums by part
+		std::thread thread;
+	};
+	struct Held
+	{
+		FramePacket * packet;
+		Worker * worker; // nullptr if it isn't being counted
+		uint64 job;
+	};
+	void work(Worker * worker);
+	// send on the held frames that are finished with, or all of them if wait
+	void release(std::vector<FramePacket*> & out, bool wait);
+	// merge the partial sums of a part and write out its projections
+	void finishPart(int part, std::vector<FramePacket*> & out);
+
+	unsigned int m_maxHeld;
+	std::vector<std::unique_ptr<Worker>> m_workers;
+	unsigned int m_nextWorker = 0;
+	std::deque<Held> m_held;
+	std::map<int, int> m_currentPart; // by stream
+	std::map<int, const PartPlan*> m_partInfo; // by part
+	unsigned int m_projected = 0;
+};
+
+/*
+Rigid motion correction of each frame before it's written, saving a
+separate read and write of the whole dataset. Frames are registered to a
+reference, the mean of the first referenceFrames frames, with
+cv::phaseCorrelate and shifted back into place (bilinear, zero filled at
+the edges). Each channel and fast-z plane gets its own reference (frames
+are matched to them by directory number, as ScanImage interleaves them).
+The first referenceFrames frames of each are held back until the
+reference is ready and then corrected like the rest.
+
+The correlation is the expensive part so frames are corrected in batches
+spread over OpenCV's thread pool (cv::parallel_for_). The shift found for
+each frame is written to shiftsFile as CSV: the source directory, the x
+and y shift in pixels that was removed and the correlation response.
+*/
+class MotionCorrection : public FrameTransform
+{
+public:
+	// reader->readheader() has to have been called for the channels and planes
+	MotionCorrection(SITiffReader * reader, unsigned int referenceFrames, const std::string & shiftsFile);
+	void process(FramePacket * packet, std::vector<FramePacket*> & out);
+	void flush(std::vector<FramePacket*> & out);
+	unsigned int maxHeld() { return m_referenceFrames * m_cycle + m_batch; }
+
+private:
+	struct Reference
+	{
+		cv::Mat sum; // CV_32FC1 while it's being built, then the mean
+		unsigned int count = 0;
+		bool ready = false;
+	};
+	int keyFor(const FramePacket * packet) { return packet->dirnum % m_cycle; }
+	void finishReference(Reference & reference);
+	// correct and send on the held frames whose references are ready, if
+	// there are a batch's worth of them or 'all'
+	void correct(std::vector<FramePacket*> & out, bool all);
+
+	unsigned int m_referenceFrames;
+	unsigned int m_cycle; // channels x planes
+	unsigned int m_batch;
+	std::map<int, Reference> m_references;
+	cv::Mat m_window; // Hanning window for the correlation
+	std::deque<FramePacket*> m_held;
+	std::map<FramePacket*, cv::Mat> m_corrected;
+	std::ofstream m_shifts;
+};
+
+#endif
@@ -0,0 +1,41 @@
+#ifndef JSON_STRING_H_
+#define JSON_STRING_H_
+
+#include <cstdio>
+#include <string>
+
+/*
+A string as a JSON string literal, quotes and all, for the JSON files
+written alongside a split (raw sidecars, manifests and dry run reports).
+Quotes, backslashes and control characters are escaped; anything else,
+UTF-8 included, goes through as it is. File names can have any of them
+*/
+inline std::string jsonString(const std::string & s)
+{
+	std::string quoted = "\"";
+	for ( char ch : s )
+	{
+		switch ( ch )
+		{
+			case '"': quoted += "\\\""; break;
+			case '\\': quoted += "\\\\"; break;
+			case '\b': quoted += "\\b"; break;
+			case '\f': quoted += "\\f"; break;
+			case '\n': quoted += "\\n"; break;
+			case '\r': quoted += "\\r"; break;
+			case '\t': quoted += "\\t"; break;
+			default:
+				if ( (unsigned char)ch < 0x20 )
+				{
+					char escaped[8];
+					snprintf(escaped, sizeof(escaped), "\\u%04x", (unsigned char)ch);
+					quoted += escaped;
+				}
+				else
+					quoted += ch;
+		}
+	}
+	return quoted + "\"";
+}
+
+#endif
@@ -0,0 +1,78 @@
+#ifndef MANIFEST_H_
+#define MANIFEST_H_
+
+#include <map>
+#include <string>
+#include <vector>
+
+#include <opencv2/core.hpp>
+
+#include "crc32c.h"
+
+/*
+CRC-32C digests of everything a split wrote, gathered by the writer as
+each frame goes out (see SplitPipeline::setManifest) so the parts can be
+checked later without having been read back at the time. Each frame gets
+two digests:
+
+	pixels - the pixel data, row by row, exactly as written (for an
+	uncompressed part that's also the concatenated strips)
+	tags - the ImageDescription followed by the Software tag, without
+	their terminating nulls
+
+and each part the CRC-32C of the digests of its frames in order, each as
+4 little-endian bytes. Written out as JSON:
+
+	{
+	  "algorithm": "crc32c",
+	  "source": "file.tif",
+	  "parts": [
+	    {
+	      "file": "base_part0.tif",
+	      "frames": 2,
+	      "pixels": "xxxxxxxx",
+	      "tags": "xxxxxxxx",
+	      "frame_digests": [
+	        {"dir": 0, "pixels": "xxxxxxxx", "tags": "xxxxxxxx"},
+	        {"dir": 1, "pixels": "xxxxxxxx", "tags": "xxxxxxxx"}
+	      ]
+	    }
+	  ]
+	}
+
+Raw output doesn't keep the tags so its manifest leaves them out
+*/
+class SplitManifest
+{
+public:
+	SplitManifest(const std::string & source, bool withTags=true) : m_source(source), m_withTags(withTags) {}
+	static uint32_t pixelDigest(const cv::Mat & frame);
+	static uint32_t tagDigest(const std::string & imDescTag, const std::string & swTag);
+	// frames are added in the order they're written to each part
+	void addFrame(const std::string & part, unsigned int dirnum, uint32_t pixels, uint32_t tags=0);
+	bool write(const std::string & filename) const;
+
+private:
+	struct Frame
+	{
+		unsigned int dirnum;
+		uint32_t pixels;
+		uint32_t tags;
+	};
+	struct Part
+	{
+		std::string filename;
+		uint32_t pixels = 0;
+		uint32_t tags = 0;
+		std::vector<Frame> frames;
+	};
+	// digest of digests, byte order fixed so it doesn't depend on the machine
+	static uint32_t chain(uint32_t crc, uint32_t digest);
+
+	std::string m_source;
+	bool m_withTags;
+	std::vector<Part> m_parts; // in the order they were started
+	std::map<std::string, std::size_t> m_index; // into m_parts
+};
+
+#endif
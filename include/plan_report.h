@@ -0,0 +1,65 @@
+#ifndef PLAN_REPORT_H_
+#define PLAN_REPORT_H_
+
+#include <ostream>
+#include <vector>
+
+#include "ScanImageTiff.h"
+#include "split_plan.h"
+
+/*
+What a split is going to do, worked out from the directory scan and the
+plan alone without reading any pixel data (the -n option): each part's
+file name, size and format, the source directories and number of frames
+going into it and the timestamps of its first and last directories, then
+the totals and a rough idea of how long it will all take. As text, or as
+JSON for a scheduler to read:
+
+	{
+	  "source": "big.tif",
+	  "source_frames": 70000,
+	  "parts": [
+	    {"file": "out_part0.tif", "stream": 0, "index": 0, "first_dir": 0, "last_dir": 9999,
+	     "frames": 10000, "bytes": 4016384, "bigtiff": false,
+	     "first_timestamp": 0.0, "last_timestamp": 333.3}
+	  ],
+	  "read_bytes": 26880000,
+	  "write_bytes": 28306316,
+	  "threads": 2,
+	  "assumed_mb_per_s": 500,
+	  "estimated_seconds": 0.1
+	}
+
+Timestamps are null if a header doesn't have one. A timed split's parts
+depend on the timestamps so every frame header is parsed to place them,
+exactly as the split itself would (see SplitPlan::timedPart). The
+estimate assumes the split runs at the speed of the disk, reading and
+writing at the same time (see SplitPipeline); compressing or motion
+correcting can take longer
+*/
+class PlanReport
+{
+public:
+	// the plan isn't const as a timed split's parts are only placed here
+	PlanReport(SITiffReader * reader, SplitPlan * plan) : m_reader(reader), m_plan(plan) {}
+	// threads the split will keep busy, for the report
+	void setThreads(unsigned int threads) { m_threads = threads; }
+	// reads the tags it needs from the source; false if it couldn't
+	bool prepare(const std::vector<DirInfo> & dirs);
+	void writeText(std::ostream & out) const;
+	void writeJSON(std::ostream & out) const;
+
+private:
+	double estimatedSeconds() const;
+
+	SITiffReader * m_reader;
+	SplitPlan * m_plan;
+	unsigned int m_threads = 2;
+	unsigned int m_sourceFrames = 0;
+	uint64 m_readBytes = 0;
+	// of the first and last directories in each part, -1 if missing
+	std::vector<double> m_firstTimes;
+	std::vector<double> m_lastTimes;
+};
+
+#endif
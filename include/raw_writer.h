@@ -0,0 +1,108 @@
+#ifndef RAW_WRITER_H_
+#define RAW_WRITER_H_
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <opencv2/core.hpp>
+
+#include "tiff_io.h"
+
+/*
+Raw output sent to a stream (see SplitPipeline::setStreamOutput) has
+nowhere to put a sidecar, so each frame goes out straight after one of
+these instead - 48 bytes in the machine's byte order, then dataBytes of
+pixels laid out as in a .bin file. A reader can check magic and skip
+headerBytes to allow for fields being added later
+*/
+struct RawFrameHeader
+{
+	char magic[4] = { 'S', 'I', 'F', 'R' };
+	uint32 headerBytes = 48;
+	uint32 dirnum = 0; // directory in the source file
+	uint32 rows = 0;
+	uint32 cols = 0;
+	uint16 bitsPerSample = 0; // these two as the tiff tags
+	uint16 sampleFormat = 0;
+	uint16 channel = 0; // saved channel number
+	uint16 plane = 0; // fast-z plane, from 1
+	uint16 samplesPerPixel = 1;
+	uint16 reserved = 0;
+	double timestamp = -1; // frameTimestamps_sec, -1 if it's missing
+	uint64 dataBytes = 0;
+};
+
+/*
+Writes the frames of a part as one flat binary file - the pixels of each
+frame, row by row, straight after those of the one before with no headers
+or padding - so analysis code can np.memmap (or mmap) the whole thing
+instead of converting the tiffs first. Everything needed to interpret the
+file goes in a JSON sidecar next to it (base_part0.bin -> base_part0.json)
+written on close():
+
+	{
+	  "file": "base_part0.bin",
+	  "dtype": "int16",
+	  "byteorder": "little",
+	  "shape": [frames, height, width],
+	  "channels": [1, 2],
+	  "planes": [1],
+	  "first": 0,
+	  "timestamps": [0.016, 0.049, ...]
+	}
+
+channels and planes are what's interleaved in the file, channel changing
+fastest, and first is where the first frame falls in that cycle, so frame
+i is channel channels[(first + i) % nchans] of plane
+planes[((first + i) / nchans) % nplanes]. timestamps are the
+frameTimestamps_sec of each frame (null where a header didn't have one).
+Every frame of a part has to be the same size and type.
+*/
+class RawWriter
+{
+public:
+	~RawWriter();
+	// write the file with O_DIRECT (see DirectFileSink)
+	void setDirectIO(bool direct) { m_directio = direct; }
+	/*
+	Starts a new file. channels, planes and first describe the
+	interleaving for the sidecar as above
+	*/
+	bool open(const std::string & filename, const std::vector<int> & channels,
+		const std::vector<int> & planes, int first);
+	bool isOpened() { return m_fd >= 0; }
+	// as TiffWriter::reserve
+	bool reserve(uint64 bytes);
+	// timestamp is -1 if it's not known
+	bool write(const cv::Mat & frame, double timestamp);
+	// closes the binary file and writes the sidecar
+	bool close();
+	/*
+	Sends frame to sink behind a RawFrameHeader, filling in its size and
+	type, and lets the sink pass it on (see TiffSink::commit)
+	*/
+	static bool streamFrame(TiffSink & sink, const cv::Mat & frame, RawFrameHeader header);
+	// numpy's name for the type of the pixels in a frame of this depth
+	static const char * dtypeName(int depth);
+
+private:
+	bool writeBytes(const uchar * data, std::size_t len);
+	bool writeSidecar();
+
+	bool m_directio = false;
+	std::unique_ptr<DirectFileSink> m_sink; // if m_directio
+	int m_fd = -1;
+	uint64 m_size = 0;
+	uint64 m_reserved = 0;
+	std::string m_filename;
+	std::vector<int> m_channels;
+	std::vector<int> m_planes;
+	int m_first = 0;
+	int m_type = -1;
+	int m_rows = 0;
+	int m_cols = 0;
+	std::vector<double> m_timestamps;
+};
+
+#endif
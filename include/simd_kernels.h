@@ -0,0 +1,68 @@
+#ifndef SIMD_KERNELS_H_
+#define SIMD_KERNELS_H_
+
+#include <cstddef>
+#include <cstdint>
+
+/*
+The per-pixel inner loops used by the frame transforms and by the colour
+conversions in utils.cpp. Each one has an SSE2 version (always available
+on x86-64) and a plain C++ fallback for anything else, and they give
+bit-for-bit the same output so a result never depends on the machine it
+was made on. Where AVX2 is worth it there is a version of that too, picked
+at runtime if the CPU has it. The 4-bit palette lookup needs a byte
+shuffle, which SSE2 doesn't have, so it's AVX2 or plain C++, and the
+8-bit one is plain C++ as nothing vectorised beat it.
+*/
+
+// sum[i] += src[i]
+void accumulate16s(const int16_t * src, int32_t * sum, std::size_t n);
+/*
+dst[i] = sum[i] / count, rounded to the nearest integer (halves to even)
+and saturated to the range of int16
+*/
+void average32s(const int32_t * sum, int16_t * dst, std::size_t n, int count);
+/*
+One row of factor x factor spatial binning (factor is 2 or 4): each of the
+'width' outputs is the mean of a factor x factor block of src, rounded to
+the nearest integer (halves up). src is the first of the factor rows that
+get binned and the rows are 'step' elements apart
+*/
+void bin16s(const int16_t * src, std::size_t step, int factor, int16_t * dst, std::size_t width);
+/*
+dst[i] = (src[i] - base) * scale, clamped to the range of the output
+type and rounded to the nearest integer (halves to even)
+*/
+void convert16sTo8u(const int16_t * src, uint8_t * dst, std::size_t n, int base, float scale);
+void convert16sTo16u(const int16_t * src, uint16_t * dst, std::size_t n, int base, float scale);
+/*
+sum[i] += src[i], sumsq[i] += src[i]^2 and max[i] = max(max[i], src[i]),
+for mean / standard deviation / maximum projections. Doubles hold the
+sums of int16s exactly for millions of frames
+*/
+void accumulateMoments16s(const int16_t * src, double * sum, double * sumsq, int16_t * max, std::size_t n);
+/*
+One row of utils.cpp's gray conversion, 0.299 R + 0.587 G + 0.114 B in
+14-bit fixed point: src has cn channels to a pixel (the vector versions
+are for 3 and 4) in BGR order, or RGB if swapRB
+*/
+void bgrToGray8u(const uint8_t * src, int cn, uint8_t * dst, std::size_t n, bool swapRB);
+void bgrToGray16u(const uint16_t * src, int cn, uint16_t * dst, std::size_t n, bool swapRB);
+// each gray value three times over
+void grayToBGR16u(const uint16_t * src, uint16_t * dst, std::size_t n);
+// drops the alpha, swapping R and B as well if asked
+void bgraToBGR16u(const uint16_t * src, uint16_t * dst, std::size_t n, bool swapRB);
+/*
+dst[i] = palette[index of pixel i] for 8, 4 and 1-bit indices, the 4 and
+1-bit ones packed most significant first. The palette has all 256, 16 or
+2 entries
+*/
+void paletteRow8(const uint8_t * indices, const uint8_t * palette, uint8_t * dst, std::size_t n);
+void paletteRow4(const uint8_t * indices, const uint8_t * palette, uint8_t * dst, std::size_t n);
+void paletteRow1(const uint8_t * indices, const uint8_t * palette, uint8_t * dst, std::size_t n);
+// true if the AVX2 versions are being used
+bool usingAVX2();
+// stops (or lets) the AVX2 versions being used, to compare them with the SSE2 ones
+void allowAVX2(bool allow);
+
+#endif
@@ -0,0 +1,70 @@
+#ifndef SPLIT_JOURNAL_H_
+#define SPLIT_JOURNAL_H_
+
+#include <string>
+#include <vector>
+
+#include <tiffio.h>
+
+#include "split_plan.h"
+
+/*
+A record of how far a split has got, so one that dies part way through
+(the node is pre-empted, the disk fills up...) can be started again
+without redoing the parts it had already finished. It's a small text file
+next to the output, <base>.journal, written like:
+
+	TiffSplitter journal 1
+	command -f big.tif -c 5000 -s out
+	source 53687091200 1718900000
+	done 0 0 4999 5000 2621968504 1c2bf0a7 out_part0.tif
+	done 1 5000 9999 5000 2621968504 9e61b2d3 out_part1.tif
+
+The command and the size and modification time of the source say which
+split it belongs to. Each done line is the part's index, its first and
+last source directories and frame count, then the size of the finished
+file and a CRC-32C of its first 4KB and last 64KB. That's where the
+header and the last directories are, so a truncated or rewritten file
+shows up without the whole thing having to be read back. The line is only
+added once the part has been flushed to disk, so the last done line is
+the last frame that's safely written.
+
+Parts are the unit of work: a resumed split starts again at the first
+part that isn't in the journal and overwrites whatever was left of it.
+The journal is deleted once the split finishes
+*/
+class SplitJournal
+{
+public:
+	SplitJournal(const std::string & filename, const std::string & command, const std::string & source) :
+		m_filename(filename), m_command(command), m_source(source) {}
+	~SplitJournal();
+	/*
+	Reads the journal left by an earlier run of the same command on the
+	same source and puts the parts it finished, that still match the
+	plan and are still intact on disk, in done. false if there's no
+	journal or it's for a different split
+	*/
+	bool resume(const SplitPlan & plan, std::vector<int> & done);
+	// starts the journal afresh with whatever resume found still done
+	bool open();
+	// flushes a finished part to disk and then records it; called from the writer
+	bool partDone(int part, const PartPlan & info);
+	// the split finished so the journal isn't needed any more
+	void remove();
+
+private:
+	// identifies the source by its size and modification time
+	bool sourceLine(std::string & line) const;
+	// size and checksum of the ends of a file, syncing it to disk first if asked
+	static bool fileDigest(const std::string & filename, bool sync, uint64 & size, uint32_t & crc);
+	bool append(const std::string & line);
+
+	std::string m_filename;
+	std::string m_command;
+	std::string m_source;
+	std::vector<std::string> m_done; // lines carried over from the journal being resumed
+	int m_fd = -1;
+};
+
+#endif
@@ -0,0 +1,157 @@
+#ifndef SPLIT_PIPELINE_H_
+#define SPLIT_PIPELINE_H_
+
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <opencv2/core.hpp>
+
+#include "ScanImageTiff.h"
+#include "manifest.h"
+#include "raw_writer.h"
+#include "split_journal.h"
+#include "split_plan.h"
+#include "spsc_queue.h"
+#include "write_tiff.h"
+
+/*
+A single frame travelling through the split pipeline. Packets are
+allocated once up front and recycled (see SplitPipeline::m_free) so the
+frame buffer is only ever allocated on the first trip round the loop
+*/
+struct FramePacket
+{
+	/*
+	What gets written. The reader decodes into 'decoded' and frame starts
+	out sharing its data; a transform that changes the size or type of the
+	frame points frame at a buffer of its own instead so 'decoded' keeps its
+	allocation from one trip round the pool to the next
+	*/
+	cv::Mat frame;
+	cv::Mat decoded;
+	std::string swTag;
+	std::string imDescTag;
+	int dirnum = -1; // directory in the source file
+	int part = -1; // output part this frame belongs to
+	const PartPlan * partInfo = nullptr; // and the part itself (see SplitPlan::timedPart)
+	bool skip = false; // dropped by a transform - the writer just recycles it
+	bool eos = false; // end of stream marker
+};
+
+/*
+Base class for anything that wants to modify frames between reading and
+writing. process() takes a packet and appends whatever is ready to go on
+to the next stage to 'out' - usually just the same packet, but a
+transform can hold packets back (up to maxHeld() of them) or mark them as
+skipped. flush() is called once the reader has finished so anything still
+held can be released.
+*/
+class FrameTransform
+{
+public:
+	virtual ~FrameTransform() {}
+	virtual void process(FramePacket * packet, std::vector<FramePacket*> & out) = 0;
+	virtual void flush(std::vector<FramePacket*> & /*out*/) {}
+	virtual unsigned int maxHeld() { return 0; }
+};
+
+/*
+Splits a tiff file using three stages, each on its own thread:
+
+	reader -> [transform] -> writer
+
+The reader fetches the tags and pixel data for each directory that the
+SplitPlan says should be written, the (optional) transform stage runs
+any FrameTransforms and the writer appends frames to the output parts
+(keeping one part open per output stream when the plan deinterleaves
+channels or planes). Stages are joined by lock-free SPSC
+queues of pointers into a fixed pool of FramePackets; the writer hands
+packets back to the reader through a third queue once they've been
+written. Read I/O, any processing and write I/O therefore overlap and the
+whole thing runs at about the speed of the slowest stage.
+*/
+class SplitPipeline
+{
+public:
+	// the plan isn't const as a timed split adds parts to it while running
+	SplitPipeline(SITiffReader * reader, SplitPlan * plan, unsigned int depth=8);
+	~SplitPipeline();
+	// the pipeline takes ownership of the transform
+	void addTransform(FrameTransform * transform);
+	// libtiff compression scheme for the output (COMPRESSION_NONE by default)
+	void setCompression(int compression) { m_compression = compression; }
+	// write the parts with O_DIRECT (see DirectFileSink)
+	void setDirectIO(bool direct) { m_directio = direct; }
+	/*
+	Write each part as a flat binary file with a JSON sidecar (see
+	RawWriter) instead of a tiff. The plan should have been made with
+	SplitPlan::setRawOutput so the parts are named and sized for it.
+	Compression and memory output only apply to tiffs
+	*/
+	void setRawOutput(bool raw) { m_raw = raw; }
+	/*
+	Send everything to fd (stdout, say) as it's written instead of to the
+	part files: a single forward-only tiff (see TiffWriter::openStream), so
+	the plan should only have the one part, or with raw output each frame
+	behind a RawFrameHeader, in which case the streams of a deinterleaved
+	plan are sent as they come
+	*/
+	void setStreamOutput(int fd) { m_streamfd = fd; }
+	/*
+	Checksum every frame as it's written and save the digests to filename
+	once the split is done (see SplitManifest)
+	*/
+	void setManifest(const std::string & filename) { m_manifestFile = filename; }
+	/*
+	Record each part in the journal once it's finished so the split can be
+	resumed from there (see SplitJournal). Parts skipped in the plan
+	aren't touched. The journal isn't owned by the pipeline
+	*/
+	void setJournal(SplitJournal * journal) { m_journal = journal; }
+	// only read and write this region of each frame (see SITiffReader::readRegion)
+	void setCrop(const cv::Rect & region) { m_crop = region; }
+	/*
+	Build each part in memory instead of writing it to part.filename.
+	The handler is called from the writer thread with each finished part
+	and should return false if it couldn't deal with it, which stops the
+	split. The buffer is reused for the next part once it returns
+	*/
+	typedef std::function<bool(const PartPlan & part, std::vector<uchar> & tiff)> PartHandler;
+	void setMemoryOutput(PartHandler handler) { m_partHandler = handler; }
+	// split the file as laid out in the plan; false on any error
+	bool run();
+	unsigned int getFramesWritten() { return m_framesWritten; }
+	unsigned int getPartsWritten() { return m_partsWritten; }
+
+private:
+	void readerStage();
+	void transformStage();
+	void writerStage();
+
+	SITiffReader * m_reader;
+	SplitPlan * m_plan;
+	unsigned int m_depth;
+	bool m_directio = false;
+	bool m_raw = false;
+	int m_streamfd = -1;
+	std::string m_manifestFile; // empty for no manifest
+	SplitJournal * m_journal = nullptr;
+	int m_compression = COMPRESSION_NONE;
+	cv::Rect m_crop; // empty for the whole frame
+	PartHandler m_partHandler;
+
+	std::vector<std::unique_ptr<FrameTransform>> m_transforms;
+	std::vector<std::unique_ptr<FramePacket>> m_pool;
+	std::unique_ptr<SPSCQueue<FramePacket*>> m_toTransform; // reader -> transform
+	std::unique_ptr<SPSCQueue<FramePacket*>> m_toWriter; // reader or transform -> writer
+	std::unique_ptr<SPSCQueue<FramePacket*>> m_free; // writer -> reader
+
+	std::atomic<bool> m_failed{false};
+	unsigned int m_framesWritten = 0;
+	unsigned int m_partsWritten = 0;
+};
+
+#endif
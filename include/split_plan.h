@@ -0,0 +1,225 @@
+#ifndef SPLIT_PLAN_H_
+#define SPLIT_PLAN_H_
+
+#include <algorithm>
+#include <deque>
+#include <string>
+#include <vector>
+
+#include "ScanImageTiff.h"
+
+// One output file
+struct PartPlan
+{
+	int index = 0; // part number within its stream
+	int stream = 0; // see SplitPlan::deinterleave
+	std::string filename;
+	unsigned int firstDir = 0; // first source directory written to this part
+	unsigned int lastDir = 0; // last source directory written to this part
+	unsigned int nframes = 0;
+	uint64 bytes = 0; // planned size of the file on disk
+	bool bigtiff = true; // false if the part is small enough for a classic tiff
+};
+
+/*
+Works out, before anything is written, which source directory goes into
+which output part and how big every part will end up. The sizes come
+from the per-directory info gathered by SITiffReader::scanDirectories so
+no pixel data is read; the writer uses them to reserve the space for each
+part up front (see TiffWriter::reserve). They also decide the format of each
+part: anything uncompressed that will comfortably fit in 4GB is written as
+a classic tiff, which has 12 rather than 20 byte IFD entries and 4 byte
+offsets, and only the bigger parts and compressed ones are written as
+BigTIFFs
+
+Frames can also be routed to separate streams of output by channel and/or
+fast-z plane (see deinterleave), each of which is chunked on its own.
+
+Splitting by time (byTime) is the exception to planning everything up
+front: the boundaries depend on the timestamps in each frame's header, which
+are only parsed as the frames are read, so the reader stage of the split
+pipeline adds those parts as it goes (see timedPart)
+*/
+class SplitPlan
+{
+public:
+	SplitPlan(std::string outputBase) : m_outputBase(outputBase) {}
+	/*
+	ScanImage interleaves the saved channels and then, with fast-z, the
+	planes in directory order. This sends each channel (byChannel) and/or
+	plane (byPlane) to its own stream of parts, named like
+	base_chan2_plane3_part0.tif. channels are the saved channel numbers in
+	the order they appear. Has to be set before byFrames or byBytes
+	*/
+	void deinterleave(const std::vector<int> & channels, int planes, bool byChannel, bool byPlane);
+	int numStreams() const { return m_streamNames.size(); }
+	// the stream directory dirnum is routed to
+	int streamFor(unsigned int dirnum) const;
+	/*
+	The saved channels and fast-z planes (from 1) that go to stream, each
+	in the order they're interleaved, and where directory dirnum falls in
+	its stream's cycle of them (the channel changing fastest)
+	*/
+	void streamLayout(int stream, std::vector<int> & channels, std::vector<int> & planes) const;
+	int cyclePosition(unsigned int dirnum) const;
+	// the saved channel and fast-z plane (from 1) of directory dirnum
+	void channelAndPlane(unsigned int dirnum, int & channel, int & plane) const;
+	// fixed number of frames per part (the -c option)
+	bool byFrames(const std::vector<DirInfo> & dirs, int chunkSize);
+	/*
+	As many frames as will fit in maxBytes per part (the -b option).
+	Fails if a single frame is bigger than that
+	*/
+	bool byBytes(const std::vector<DirInfo> & dirs, uint64 maxBytes);
+	/*
+	A new part every 'seconds' of acquisition time (if seconds > 0) and/or
+	at every new acquisition trigger or next-file marker (if onTriggers).
+	Nothing is assigned until the pipeline calls timedPart
+	*/
+	bool byTime(const std::vector<DirInfo> & dirs, double seconds, bool onTriggers);
+	bool isTimed() const { return m_timed; }
+	/*
+	Called by the reader for each frame, in order, with the timing from
+	its header; returns the part it goes in, starting a new one at each
+	window or trigger. Parts are kept in a deque so the writer can hold on
+	to a reference to one while the reader is adding the next
+	*/
+	int timedPart(unsigned int dirnum, const FrameTimes & times);
+	/*
+	Works out how big the parts of a timed split will be once timedPart
+	has placed every frame. The writer doesn't need to know, this is for
+	a dry run (see PlanReport)
+	*/
+	void sizeTimedParts(const std::vector<DirInfo> & dirs);
+	/*
+	The libtiff compression scheme the parts will be written with. Needs
+	setting before the parts are planned as it changes their sizes
+	*/
+	void setCompression(int compression) { m_compression = compression; }
+	int getCompression() const { return m_compression; }
+	/*
+	Every 'frames' frames of each channel and plane of a stream will be
+	averaged into one (see TemporalBinning) so chunk sizes and part sizes
+	count binned frames. A bin never carries on into the next part, and a
+	part only ends early on a bin where it can't be helped (timed splits).
+	Set before planning, after deinterleave
+	*/
+	void setTemporalBin(unsigned int frames) { m_bin = std::max(1u, frames); }
+	/*
+	The bin directory dirnum is averaged in, one for each channel and plane
+	of each stream, the channel changing fastest
+	*/
+	int binFor(unsigned int dirnum) const { return streamFor(dirnum) * binCycle() + cyclePosition(dirnum); }
+	int numBins() const { return numStreams() * binCycle(); }
+	// only this region of each frame will be written (see SplitPipeline::setCrop)
+	void setCrop(const cv::Rect & region) { m_crop = region; }
+	// the frames will be converted to this many bits (see DisplayConversion); 0 leaves them as they are
+	void setBitsPerSample(int bits) { m_bitsPerSample = bits; }
+	// the frames will be binned factor x factor (see SpatialBinning)
+	void setSpatialBin(int factor) { m_spatialBin = std::max(1, factor); }
+	// the parts will be flat binary files (see RawWriter) named .bin instead of tiffs
+	void setRawOutput(bool raw) { m_raw = raw; }
+	bool isRawOutput() const { return m_raw; }
+	// the part directory dirnum goes to, or -1 if it isn't written at all
+	int partFor(unsigned int dirnum) const;
+	/*
+	Leaves out a part that's already been written (see SplitJournal) so
+	none of its directories are read again. The part keeps its place and
+	name so the ones after it are unchanged
+	*/
+	void skipPart(int part);
+	const PartPlan & getPart(int part) const { return m_parts[part]; }
+	int numParts() const { return m_parts.size(); }
+	unsigned int numDirs() const { return m_dirToPart.size(); }
+	uint64 totalBytes() const;
+	std::string partName(int stream, int part) const;
+
+private:
+	/*
+	Follows TiffWriter's tag sharing through a part: a tag value that's
+	the same as the last one stored in full for either tag costs nothing
+	*/
+	struct SharedTags
+	{
+		uint32 imDescLen = 0;
+		std::size_t imDescHash = 0;
+		uint32 swLen = 0;
+		std::size_t swHash = 0;
+		// bytes of the value that will actually be stored
+		uint32 add(uint32 len, std::size_t hash, bool imDesc);
+	};
+	// sizes of the frames as they'll be written, from their DirInfo
+	uint64 frameBytes(const DirInfo & info, SharedTags & shared, bool bigtiff) const;
+	// what adding the frame to part (or a new part if -1) would cost
+	uint64 frameBytes(const DirInfo & info, int part, bool bigtiff) const;
+	// bytes in a part before any frames
+	uint64 headerBytes(bool bigtiff) const;
+	// starts a new part in stream and returns its index in m_parts
+	int newPart(int stream);
+	// written is false for the frames that get averaged into the first of their bin
+	void addToPart(int part, unsigned int dirnum, const DirInfo & info, bool written=true);
+	void clear(unsigned int ndirs);
+	// once every frame is placed pick classic tiff for the parts that can take it
+	void chooseFormats();
+	// the channels and planes interleaved in each stream
+	int binCycle() const;
+	/*
+	Follows TemporalBinning's bins through the frames in order: a frame
+	starts a new bin (and is the one written) every m_bin frames of its
+	bin, or whenever it goes in a different part to the last one
+	*/
+	struct BinState
+	{
+		std::vector<unsigned int> frames; // in each bin so far
+		std::vector<int> parts; // the part each bin is in
+		BinState(int nbins = 0) : frames(nbins, 0), parts(nbins, -1) {}
+		bool starts(int bin, int part, unsigned int binFrames) const
+		{
+			return part != parts[bin] || frames[bin] % binFrames == 0;
+		}
+		void add(int bin, int part);
+	};
+	/*
+	Only uncompressed parts can be classic tiffs. The size of a compressed
+	frame is only known to within a bound (see TiffWriter::estimateFrameBytes)
+	and libtiff can't carry on past 4GB if a classic part ever got there
+	*/
+	bool classicAllowed() const { return m_compression == COMPRESSION_NONE; }
+
+	std::string m_outputBase;
+	int m_compression = COMPRESSION_NONE;
+	unsigned int m_bin = 1;
+	int m_spatialBin = 1;
+	cv::Rect m_crop;
+	int m_bitsPerSample = 0;
+	bool m_raw = false;
+	std::vector<int> m_channels;
+	int m_planes = 1;
+	bool m_byChannel = false;
+	bool m_byPlane = false;
+	std::vector<std::string> m_streamNames{""}; // goes between the base and "_part"
+	std::vector<int> m_streamParts; // parts started so far in each stream
+
+	// byTime
+	bool m_timed = false;
+	double m_seconds = 0;
+	bool m_onTriggers = false;
+	std::vector<uint64> m_remainingClassic; // classic size of each stream from each dir on
+	struct TimedState
+	{
+		bool started = false;
+		int epoch = 0; // bumped at every trigger
+		double epochStart = 0; // timestamp the windows are counted from
+		double lastTimestamp = 0;
+		FrameTimes last;
+	} m_timing;
+	std::vector<std::pair<int, long>> m_streamWindow; // epoch and window of the current part in each stream
+	std::vector<int> m_streamCurrent; // and the part itself
+	BinState m_timedBins;
+	std::deque<PartPlan> m_parts;
+	std::vector<uint64> m_classicBytes; // size of each part if written as a classic tiff
+	std::vector<SharedTags> m_shared; // for each part
+	std::vector<int> m_dirToPart;
+};
+
+#endif
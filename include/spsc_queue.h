@@ -0,0 +1,95 @@
+#ifndef SPSC_QUEUE_H_
+#define SPSC_QUEUE_H_
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <thread>
+#include <vector>
+
+/*
+Bounded lock-free single-producer / single-consumer ring buffer.
+Exactly one thread may call push() and exactly one (other) thread may
+call pop() - that's all the split pipeline needs as each queue joins
+two neighbouring stages. The head and tail counters are padded out
+to separate cache lines so the two threads don't keep stealing the line
+from each other. Capacity is rounded up to a power of two so indexing is a mask.
+*/
+template <typename T>
+class SPSCQueue
+{
+public:
+	explicit SPSCQueue(std::size_t capacity)
+	{
+		std::size_t size = 2;
+		while ( size < capacity )
+			size <<= 1;
+		m_slots.resize(size);
+		m_mask = size - 1;
+	}
+	SPSCQueue(const SPSCQueue &) = delete;
+	SPSCQueue & operator = (const SPSCQueue &) = delete;
+
+	// Returns false if the queue is full
+	bool push(const T & item)
+	{
+		const std::size_t tail = m_tail.load(std::memory_order_relaxed);
+		if ( tail - m_head.load(std::memory_order_acquire) > m_mask )
+			return false;
+		m_slots[tail & m_mask] = item;
+		m_tail.store(tail + 1, std::memory_order_release);
+		return true;
+	}
+	// Returns false if the queue is empty
+	bool pop(T & item)
+	{
+		const std::size_t head = m_head.load(std::memory_order_relaxed);
+		if ( head == m_tail.load(std::memory_order_acquire) )
+			return false;
+		item = m_slots[head & m_mask];
+		m_head.store(head + 1, std::memory_order_release);
+		return true;
+	}
+	/*
+	Blocking versions. A stage that is waiting on its neighbour spins
+	briefly, then yields and finally naps so that a stalled writer (e.g.
+	a slow disk) doesn't leave the reader burning a core
+	*/
+	void waitPush(const T & item)
+	{
+		for (unsigned int spins = 0; ! push(item); ++spins)
+			backoff(spins);
+	}
+	void waitPop(T & item)
+	{
+		for (unsigned int spins = 0; ! pop(item); ++spins)
+			backoff(spins);
+	}
+	std::size_t capacity() const { return m_mask + 1; }
+	std::size_t size() const
+	{
+		return m_tail.load(std::memory_order_acquire) - m_head.load(std::memory_order_acquire);
+	}
+
+private:
+	static void backoff(unsigned int spins)
+	{
+		if ( spins < 64 )
+			return;
+		else if ( spins < 256 )
+			std::this_thread::yield();
+		else
+			std::this_thread::sleep_for(std::chrono::microseconds(50));
+	}
+	// (padding rather than alignas as C++14 new ignores over-alignment)
+	static const std::size_t cacheline = 64;
+	char m_pad0[cacheline];
+	std::atomic<std::size_t> m_head{0}; // next slot to pop
+	char m_pad1[cacheline - sizeof(std::atomic<std::size_t>)];
+	std::atomic<std::size_t> m_tail{0}; // next slot to push
+	char m_pad2[cacheline - sizeof(std::atomic<std::size_t>)];
+	std::vector<T> m_slots;
+	std::size_t m_mask;
+};
+
+#endif
@@ -0,0 +1,168 @@
+#ifndef TIFF_IO_H_
+#define TIFF_IO_H_
+
+#include <tiffio.h>
+#include <string>
+#include <vector>
+
+/*
+Somewhere for TiffWriter to put its bytes other than a plain file. A sink
+is handed to libtiff through TIFFClientOpen so libtiff does all its usual
+seeking, reading back and patching of IFD offsets against it and neither
+it nor the writer need to know where the data actually ends up.
+*/
+class TiffSink
+{
+public:
+	virtual ~TiffSink() {}
+	virtual tmsize_t read(void * buf, tmsize_t size) = 0;
+	virtual tmsize_t write(const void * buf, tmsize_t size) = 0;
+	virtual toff_t seek(toff_t offset, int whence) = 0;
+	virtual toff_t size() = 0;
+	// called by TIFFClose - anything buffered must be written out here
+	virtual int close() = 0;
+	// the underlying file descriptor, if there is one (see TiffWriter::reserve)
+	virtual int fileno() { return -1; }
+	// set aside room for 'bytes' of output if the sink can do that itself
+	virtual bool reserve(uint64 /*bytes*/) { return false; }
+	/*
+	Nothing before 'offset' will be read or written again, so a sink that
+	can't seek back (see StreamSink) is free to pass it on
+	*/
+	virtual void commit(uint64 /*offset*/) {}
+	/*
+	Opens a TIFF on top of this sink with the usual TIFFOpen mode string.
+	The sink has to outlive the returned handle
+	*/
+	TIFF * openTiff(const std::string & name, const char * mode);
+};
+
+/*
+Writes a file opened with O_DIRECT, bypassing the page cache entirely, so
+splitting a huge file doesn't evict everything else from memory.
+O_DIRECT needs the buffer, the file offset and the length of every
+transfer to be block-aligned, so output is staged in a page-aligned buffer
+holding the tail of the file and only written out in whole blocks of
+blockSize bytes. The odd occasions libtiff goes back and patches something
+that's already gone to disk (the next-IFD offset of the previous
+directory) are done as an aligned read-modify-write. That relies on
+libtiff 4.5 or later (see ScanImageTiff.h), which remembers where the last
+IFD is; older ones walk every IFD from the header for each directory
+written, which here would be a direct read of each of them per frame.
+The last few blocks read back are kept, so reading an IFD and then
+patching it - TiffWriter::patchSharedTags does that to each IFD with a
+shared tag on close - costs one aligned read and one write. The unaligned
+tail is written padded on close and the file then truncated to its real
+length.
+
+If the filesystem won't do O_DIRECT (tmpfs for instance) the file is opened
+normally and each block is dropped from the page cache once it's written,
+which gets most of the benefit.
+*/
+class DirectFileSink : public TiffSink
+{
+public:
+	DirectFileSink(size_t blockSize = 8 << 20);
+	~DirectFileSink();
+	bool open(const std::string & filename);
+	bool isDirect() { return m_direct; }
+
+	tmsize_t read(void * buf, tmsize_t size);
+	tmsize_t write(const void * buf, tmsize_t size);
+	toff_t seek(toff_t offset, int whence);
+	toff_t size() { return m_size; }
+	int close();
+	int fileno() { return m_fd; }
+
+private:
+	// block-aligned read-modify-write / read of bytes that are already on disk
+	bool patchDisk(uint64 pos, const unsigned char * data, size_t len);
+	bool readDisk(uint64 pos, unsigned char * data, size_t len);
+	// the cached copy of the on-disk block at 'block', read in if need be; null on error
+	unsigned char * diskBlock(uint64 block);
+	// write out the whole staging buffer and move it on to the next block
+	bool flushBlock();
+
+	static const size_t alignment = 4096;
+	static const int cacheBlocks = 8;
+	int m_fd = -1;
+	bool m_direct = false;
+	size_t m_blockSize;
+	unsigned char * m_buf = nullptr; // staging buffer for the tail of the file
+	unsigned char * m_cache = nullptr; // cacheBlocks aligned blocks already on disk
+	uint64 m_cacheOffset[cacheBlocks]; // file offset of each, or ~0 if unused
+	int m_cacheNext = 0; // the one to replace next
+	uint64 m_bufStart = 0; // file offset of m_buf[0]
+	uint64 m_pos = 0; // current position
+	uint64 m_size = 0; // logical length of the file
+};
+
+/*
+Writes into a caller-owned vector so a TIFF can be produced without going
+anywhere near the filesystem. The vector grows as libtiff writes (and
+libtiff can seek back and patch it as usual); when the TIFF is closed
+it holds the complete file.
+*/
+class MemorySink : public TiffSink
+{
+public:
+	MemorySink(std::vector<unsigned char> & buf) : m_buf(buf) { m_buf.clear(); }
+
+	tmsize_t read(void * buf, tmsize_t size);
+	tmsize_t write(const void * buf, tmsize_t size);
+	toff_t seek(toff_t offset, int whence);
+	toff_t size() { return m_buf.size(); }
+	int close() { return 0; }
+	bool reserve(uint64 bytes) { m_buf.reserve(bytes); return true; }
+
+private:
+	std::vector<unsigned char> & m_buf;
+	uint64 m_pos = 0;
+};
+
+/*
+Writes to a pipe (or anything else that can't seek) such as stdout, so a
+split can feed another process directly. libtiff still seeks back to
+patch the header after the first directory and the next-IFD offset of
+the previous directory after each one, so the sink keeps the tail of the
+output in memory from the oldest byte that might still be touched (see
+commit) and serves those seeks and reads from there; everything before
+it is final and goes out in large writes of blockSize bytes. That needs
+libtiff 4.5 or later (see ScanImageTiff.h) - older ones read back every
+IFD from the header for each directory written, which would fail here
+once the first block had gone. A blocking write into a full pipe stalls
+the writer, which in turn backs up the split pipeline, so a slow consumer
+just slows the whole thing down. Seeking back past what's been passed on
+is an error.
+
+The descriptor is left open on close.
+*/
+class StreamSink : public TiffSink
+{
+public:
+	StreamSink(int fd, size_t blockSize = 8 << 20);
+	~StreamSink() { close(); }
+
+	tmsize_t read(void * buf, tmsize_t size);
+	tmsize_t write(const void * buf, tmsize_t size);
+	toff_t seek(toff_t offset, int whence);
+	toff_t size() { return m_size; }
+	// passes everything still held on
+	int close();
+	void commit(uint64 offset);
+
+private:
+	// write out the first len bytes held
+	bool flush(size_t len);
+
+	int m_fd;
+	size_t m_blockSize;
+	std::vector<unsigned char> m_buf; // everything from m_bufStart to the end
+	uint64 m_bufStart = 0; // file offset of m_buf[0]
+	uint64 m_committed = 0; // see commit
+	uint64 m_pos = 0;
+	uint64 m_size = 0;
+	bool m_failed = false;
+};
+
+#endif
@@ -0,0 +1,37 @@
+#ifndef TIFF_MERGE_H_
+#define TIFF_MERGE_H_
+
+#include <string>
+#include <vector>
+
+#include "write_tiff.h"
+
+/*
+The reverse of a split: joins tiff files - the parts written by a split or
+several separate acquisitions - into a single BigTIFF, in the order they
+were added. Each input is read straight through with TIFFReadDirectory
+(stopping anywhere but the end of its IFD chain is an error) and every
+directory copied raw (see TiffWriter::copyDirectory), so the strips are
+never decoded and only one of them is in memory at a time however big the
+inputs are. The output can hold any number of frames
+*/
+class TiffMerger
+{
+public:
+	TiffMerger(std::string outputFile) : m_outputFile(outputFile) {}
+	void addInput(const std::string & filename) { m_inputs.push_back(filename); }
+	// write the output with O_DIRECT (see DirectFileSink)
+	void setDirectIO(bool direct) { m_directio = direct; }
+	bool run();
+	unsigned int getFramesWritten() { return m_framesWritten; }
+
+private:
+	bool appendFile(cv::TiffWriter & writer, const std::string & filename);
+
+	std::string m_outputFile;
+	std::vector<std::string> m_inputs;
+	bool m_directio = false;
+	unsigned int m_framesWritten = 0;
+};
+
+#endif
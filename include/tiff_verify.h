@@ -0,0 +1,75 @@
+#ifndef TIFF_VERIFY_H_
+#define TIFF_VERIFY_H_
+
+#include <string>
+#include <vector>
+
+#include <tiffio.h>
+
+/*
+Checks that the parts of a split, taken in the order they were added,
+hold exactly the frames of the file they were split from: the same number
+of them, each the same size and type with the same ImageDescription and
+Software tags and the same pixels. Only CRC-32C digests of each frame are
+compared (see crc32c.h) so nothing is held in memory but one strip.
+
+The source and the parts are each read straight through on their own
+thread, the parts several at a time, so on storage that can keep up the
+whole check takes about as long as reading the source once. Uncompressed
+strips in the machine's byte order - what a split normally writes - are
+digested as they sit on disk with TIFFReadRawStrip, without going
+through libtiff's decoding at all; compressed, byte-swapped or tiled
+images are decoded first so they still compare equal to the same pixels
+stored some other way. A directory that can't be read fails the check,
+even where it cuts a file short rather than corrupting a frame, so a
+truncated part is never taken for a short one.
+
+Only plain splits can be checked like this: frames that were binned,
+cropped, converted or deinterleaved won't match the source (the manifest
+written with -e covers those)
+*/
+class TiffVerifier
+{
+public:
+	TiffVerifier(const std::string & source) : m_source(source) {}
+	void addPart(const std::string & filename) { m_parts.push_back(filename); }
+	// the ScanImage version of the source, which decides what a split does with its Software
+	// tag (see SITiffReader::readTags); the default of 1 expects it to be copied as it is
+	void setSourceVersion(int version) { m_version = version; }
+	// how many files to read at once, the source included
+	void setThreads(unsigned int threads) { m_threads = threads < 2 ? 2 : threads; }
+	// true if every frame matches
+	bool run();
+	unsigned int getFramesChecked() { return m_framesChecked; }
+	unsigned int getMismatches() { return m_mismatches; }
+
+private:
+	struct FrameDigest
+	{
+		uint32 width = 0;
+		uint32 height = 0;
+		uint16 bitsPerSample = 0;
+		uint16 samplesPerPixel = 0;
+		uint32 pixels = 0;
+		uint32 tags = 0;
+	};
+	struct FileDigests
+	{
+		std::string filename;
+		std::vector<FrameDigest> frames;
+		bool ok = false;
+	};
+	static void digestFile(FileDigests & file, int version);
+	static bool digestDirectory(TIFF * tif, int version, FrameDigest & digest, std::vector<unsigned char> & buffer);
+	// prints what's different about a frame, and counts it, for the first few that are
+	void mismatch(const std::string & part, unsigned int frame, unsigned int dirnum, const std::string & what);
+
+	std::string m_source;
+	std::vector<std::string> m_parts;
+	int m_version = 1;
+	unsigned int m_threads = 4;
+	unsigned int m_framesChecked = 0;
+	unsigned int m_mismatches = 0;
+};
+
+#endif
@@ -16,7 +16,9 @@
 #include <tiffio.h>
 #include <opencv2/core.hpp>
 #include <exception>
+#include <memory>
 #include "bitstrm.hpp"
+#include "tiff_io.h"
 #include "utils.hpp"
 
 namespace cv
@@ -96,10 +98,68 @@ public:
 	bool  write( const cv::Mat& img, const std::vector<int>& params );
 
 	virtual bool isOpened();
-	virtual bool open(cv::String outputPath);
+    /*
+    With bigtiff false a classic tiff is written, which is smaller and
+    quicker to scan but can't go past 4GB
+    */
+	virtual bool open(cv::String outputPath, bool bigtiff=true);
+    /*
+    Write the TIFF into 'buf' rather than a file. The buffer grows as
+    frames are added and holds the complete file once close() returns
+    */
+	virtual bool open(std::vector<uchar> & buf, bool bigtiff=true);
+    /*
+    Write the TIFF to a descriptor that can't seek, such as stdout, as it
+    goes (see StreamSink). Tags aren't shared (see setShareTags) as that
+    needs going back over the whole file once it's complete
+    */
+	virtual bool openStream(int fd, bool bigtiff=true);
+    /*
+    Write files opened after this with O_DIRECT (see DirectFileSink) so
+    they don't go through the page cache
+    */
+    void setDirectIO(bool direct) { m_directio = direct; }
     virtual bool close();
 	virtual TiffWriter& operator << (cv::Mat& frame);
     bool writeSIHdr(const std::string swTag, const std::string imDescTag);
+    /*
+    The Software tag of a ScanImage file is several KB and is the same for
+    every frame. With sharing on (the default) a long tag value that is
+    identical to the last one written for either the Software or the
+    ImageDescription tag is only stored once: the later IFDs get an empty
+    placeholder and close() points their entries at the earlier copy
+    */
+    void setShareTags(bool share) { m_shareTags = share; }
+    /*
+    Appends the current directory of src without decoding it: the image
+    tags are copied across and the strips (or tiles) copied byte for byte,
+    so nothing is decompressed and compressed again and only one strip is
+    held in memory. Compression schemes that need more than the strips
+    (JPEG tables and the like) or that this libtiff wasn't built with are
+    decoded and written uncompressed instead, as are samples wider than a
+    byte from a file in the other byte order
+    */
+    bool copyDirectory(TIFF * src);
+    /*
+    Reserves 'bytes' on disk for the open file with fallocate so a part
+    is laid out contiguously rather than growing a frame at a time. The
+    file size isn't changed (libtiff appends at end-of-file) and any of
+    the reservation that isn't used is handed back on close(). For a
+    memory destination this just reserves the buffer's capacity
+    */
+    bool reserve(uint64 bytes);
+    /*
+    Upper bound on the number of bytes a single frame adds to the output
+    file: the strip plus the IFD and any tag values too big to fit in
+    their IFD entries. Lets a split be planned before anything is written.
+    A compressed strip is charged the most its scheme can possibly grow
+    the pixels to (see compressedBound in write_tiff.cpp), as noise or
+    anything else that won't compress can come out bigger than it went in
+    */
+    static uint64 estimateFrameBytes(int width, int height, int bitsPerSample, int channels,
+                                     size_t imDescLen, size_t swLen, bool bigtiff=true,
+                                     int compression=COMPRESSION_NONE);
+    static uint64 headerBytes(bool bigtiff=true) { return bigtiff ? 16 : 8; }
 
 protected:
     void  writeTag( cv::WLByteStream& strm, TiffTag tag,
@@ -113,6 +173,32 @@ protected:
 	int frame_number = 1;
 	double time_stamp = 0;
 	bool opened = false;
+	uint64 m_reserved = 0;
+	void releaseReservation();
+	// where libtiff's output goes if it isn't straight to a file with TIFFOpen
+	std::unique_ptr<TiffSink> m_sink;
+	bool m_directio = false;
+	int m_streamfd = -1; // see openStream
+	uint64 m_lastFrameStart = 0; // where the previous frame started in a sink
+	bool m_bigtiff = true;
+	int fileDescriptor();
+	// opens libtiff on m_buf if that's the destination, otherwise on the file 'name'
+	TIFF * openDestination(const cv::String & name);
+	// see setShareTags
+	struct SharedTag
+	{
+		uint32 dir; // IFD with the placeholder
+		uint16 tag; // the placeholder tag
+		uint16 source; // tag whose last full value it should point at
+	};
+	const char * shareTag(uint16 tag, const std::string & value);
+	bool patchSharedTags();
+	bool m_shareTags = true;
+	std::vector<SharedTag> m_sharedTags;
+	std::string m_lastImDesc;
+	std::string m_lastSw;
+	uint32 m_dirsWritten = 0;
+	std::vector<uchar> m_stripBuffer; // for copyDirectory
 };
 
 } // namespace cv
@@ -1,9 +1,13 @@
 #include "../include/ScanImageTiff.h"
+#include "../include/simd_kernels.h"
 
 #include <stdio.h>
 #include <stdio_ext.h>
 
+#include <algorithm>
+#include <iterator>
 #include <limits>
+#include <stdexcept>
 
 void SITiffHeader::read(TIFF * m_tif, int dirnum)
 {
@@ -43,8 +47,14 @@ void SITiffHeader::versionCheck(TIFF * m_tif)
 			channelSaved = "scanimage.SI5.channelsSave =";
 			channelLUT = "scanimage.SI5.chan1LUT =";
 			channelOffsets = "scanimage.SI5.channelOffsets =";
+			numSlices = "scanimage.SI5.stackNumSlices =";
+			fastZEnable = "scanimage.SI5.fastZEnable =";
+			fastZFlyback = "scanimage.SI5.fastZNumDiscardFrames =";
+			fastZDiscardFlyback = "scanimage.SI5.fastZDiscardFlybackFrames =";
 			frameString = "Frame Number =";
 			frameTimeStamp = "Frame Timestamp(s) =";
+			linesPerFrame = "scanimage.SI5.linesPerFrame =";
+			pixelsPerLine = "scanimage.SI5.pixelsPerLine =";
 		}
 		else if ( ! grabStr(m_imdesc, "frameNumbers =").empty() ) // new
 		{
@@ -53,8 +63,16 @@ void SITiffHeader::versionCheck(TIFF * m_tif)
 			channelLUT = "SI.hChannels.channelLUT =";
 			channelOffsets = "SI.hChannels.channelOffset =";
 			channelNames = "SI.hChannels.channelName =";
+			numSlices = "SI.hStackManager.numSlices =";
+			fastZEnable = "SI.hFastZ.enable =";
+			fastZFlyback = "SI.hFastZ.numDiscardFlybackFrames =";
+			fastZDiscardFlyback = "SI.hFastZ.discardFlybackFrames =";
 			frameString = "frameNumbers =";
 			frameTimeStamp = "frameTimestamps_sec =";
+			linesPerFrame = "SI.hRoiManager.linesPerFrame =";
+			pixelsPerLine = "SI.hRoiManager.pixelsPerLine =";
+			acqTriggerTimeStamps = "acqTriggerTimestamps_sec =";
+			nextFileMarkerTimeStamps = "nextFileMarkerTimestamps_sec =";
 		}
 
 		uint32 length;
@@ -69,7 +87,7 @@ std::string SITiffHeader::getSoftwareTag(TIFF * m_tif, unsigned int dirnum)
 {
 	if ( m_tif )
 	{
-		TIFFSetDirectory(m_tif, dirnum);
+		gotoDirectory(m_tif, dirnum);
 		if ( version == 0 )
 		{
 			// with older versions the information for channels live
@@ -79,7 +97,11 @@ std::string SITiffHeader::getSoftwareTag(TIFF * m_tif, unsigned int dirnum)
 			if ( ! imdesc.empty() )
 			{
 				std::string chanSave = grabStr(imdesc, channelSaved);
-				chanSaved[0] = 1;
+				if ( chanSave.empty() )
+					chanSaved[0] = 1;
+				else
+					parseSavedChannels(chanSave);
+				parseStack(imdesc);
 
 				std::string chanLUTs = grabStr(imdesc, channelLUT);
 				parseChannelLUT(chanLUTs);
@@ -105,6 +127,7 @@ std::string SITiffHeader::getSoftwareTag(TIFF * m_tif, unsigned int dirnum)
 				parseChannelLUT(chanLUTs);
 				parseChannelOffsets(chanOffsets);
 				parseSavedChannels(chanSave);
+				parseStack(m_swTag);
 				return m_swTag;
 			}
 			else
@@ -120,7 +143,7 @@ std::string SITiffHeader::getImageDescTag(TIFF * m_tif, unsigned int dirnum)
 {
 	if ( m_tif )
 	{
-		TIFFSetDirectory(m_tif, dirnum);
+		gotoDirectory(m_tif, dirnum);
 		char * imdesc;
 		if ( TIFFGetField(m_tif, TIFFTAG_IMAGEDESCRIPTION, &imdesc) == 1)
 		{
@@ -159,7 +182,7 @@ unsigned int SITiffHeader::getSizePerDir(TIFF * m_tif, unsigned int dirnum)
 {
 	if ( m_tif )
 	{
-		TIFFSetDirectory(m_tif, dirnum);
+		gotoDirectory(m_tif, dirnum);
 		uint32 length;
 		uint32 width;
 		TIFFGetField(m_tif, TIFFTAG_IMAGELENGTH, &length);
@@ -172,6 +195,20 @@ unsigned int SITiffHeader::getSizePerDir(TIFF * m_tif, unsigned int dirnum)
 		return 0;
 }
 
+bool SITiffHeader::gotoDirectory(TIFF * m_tif, unsigned int dirnum)
+{
+	if ( m_tif )
+	{
+		tdir_t current = TIFFCurrentDirectory(m_tif);
+		if ( current == dirnum )
+			return true;
+		if ( current + 1 == dirnum )
+			return TIFFReadDirectory(m_tif) == 1;
+		return TIFFSetDirectory(m_tif, dirnum) == 1;
+	}
+	return false;
+}
+
 void SITiffHeader::printHeader(TIFF * m_tif, int framenum)
 {
 	if ( m_tif )
@@ -209,6 +246,50 @@ int SITiffHeader::countDirectories(TIFF * m_tif, int & count)
 	return 1;
 }
 
+int SITiffHeader::scanDirectories(TIFF * m_tif, std::vector<DirInfo> & dirs)
+{
+	dirs.clear();
+	if ( m_tif && gotoDirectory(m_tif, 0) )
+	{
+		do {
+			DirInfo info;
+			TIFFGetField(m_tif, TIFFTAG_IMAGEWIDTH, &info.width);
+			TIFFGetField(m_tif, TIFFTAG_IMAGELENGTH, &info.height);
+			TIFFGetField(m_tif, TIFFTAG_BITSPERSAMPLE, &info.bitsPerSample);
+			TIFFGetField(m_tif, TIFFTAG_SAMPLESPERPIXEL, &info.samplesPerPixel);
+			TIFFGetField(m_tif, TIFFTAG_COMPRESSION, &info.compression);
+			uint64 * counts;
+			if ( TIFFGetField(m_tif, TIFFTAG_STRIPBYTECOUNTS, &counts) == 1 )
+			{
+				uint32 nstrips = TIFFNumberOfStrips(m_tif);
+				for (uint32 i = 0; i < nstrips; ++i)
+					info.stripBytes += counts[i];
+			}
+			char * tag;
+			std::hash<std::string> hash;
+			if ( TIFFGetField(m_tif, TIFFTAG_IMAGEDESCRIPTION, &tag) == 1 )
+			{
+				info.imDescLen = strlen(tag);
+				info.imDescHash = hash(tag);
+			}
+			// version 0 files get the ImageDescription copied into Software
+			if ( version == 0 )
+			{
+				info.swLen = info.imDescLen;
+				info.swHash = info.imDescHash;
+			}
+			else if ( TIFFGetField(m_tif, TIFFTAG_SOFTWARE, &tag) == 1 )
+			{
+				info.swLen = strlen(tag);
+				info.swHash = hash(tag);
+			}
+			dirs.push_back(info);
+		}
+		while ( TIFFReadDirectory(m_tif) == 1 );
+	}
+	return dirs.size();
+}
+
 int SITiffHeader::scrapeHeaders(TIFF * m_tif, int & count)
 {
 	if ( m_tif )
@@ -238,6 +319,33 @@ int SITiffHeader::scrapeHeaders(TIFF * m_tif, int & count)
 	return 1;
 }
 
+bool SITiffHeader::parseFrameTimes(const std::string & imdesc, FrameTimes & times)
+{
+	times = FrameTimes();
+	// older versions don't record the triggers
+	if ( ! acqTriggerTimeStamps.empty() )
+		times.acqTriggers = grabStr(imdesc, acqTriggerTimeStamps);
+	if ( ! nextFileMarkerTimeStamps.empty() )
+		times.nextFileMarkers = grabStr(imdesc, nextFileMarkerTimeStamps);
+	std::string ts = grabStr(imdesc, frameTimeStamp);
+	if ( ts.empty() ) // sometimes headers are corrupted esp. at EOF
+		return false;
+	// a garbled value is no timestamp either, rather than an exception on the reader's thread
+	try
+	{
+		times.timestamp = std::stod(ts);
+	}
+	catch ( const std::invalid_argument & )
+	{
+		return false;
+	}
+	catch ( const std::out_of_range & )
+	{
+		return false;
+	}
+	return true;
+}
+
 void SITiffHeader::parseChannelLUT(std::string LUT)
 {
 	LUT.pop_back();
@@ -294,6 +402,22 @@ void SITiffHeader::parseSavedChannels(std::string savedchans)
 	}
 }
 
+void SITiffHeader::parseStack(const std::string & source)
+{
+	numPlanes = 1;
+	std::string enabled = grabStr(source, fastZEnable);
+	if ( enabled.find("true") == std::string::npos && enabled.find('1') == std::string::npos )
+		return;
+	std::string slices = grabStr(source, numSlices);
+	if ( ! slices.empty() )
+		numPlanes = std::max(1, std::stoi(slices));
+	// flyback frames are saved along with the planes unless they're discarded
+	std::string discard = grabStr(source, fastZDiscardFlyback);
+	std::string flyback = grabStr(source, fastZFlyback);
+	if ( ! flyback.empty() && ( discard.find("false") != std::string::npos || discard == " 0" ) )
+		numPlanes += std::max(0, std::stoi(flyback));
+}
+
 /* -----------------------------------------------------------
 class SITiffReader
 ------------------------------------------------------------*/
@@ -357,6 +481,28 @@ void SITiffReader::getFrameNumAndTimeStamp(const unsigned int dirnum, unsigned i
 		timestamp = std::stof(ts);
 	}
 }
+bool SITiffReader::readTags(int dirnum, std::string & swTag, std::string & imDescTag)
+{
+	if ( m_tif )
+	{
+		if ( ! headerdata->gotoDirectory(m_tif, dirnum) )
+			return false;
+		char * tag;
+		if ( TIFFGetField(m_tif, TIFFTAG_IMAGEDESCRIPTION, &tag) == 1 )
+			imDescTag = tag;
+		else
+			imDescTag.clear();
+		if ( getVersion() == 0 )
+			swTag = imDescTag;
+		else if ( getVersion() == 1 && TIFFGetField(m_tif, TIFFTAG_SOFTWARE, &tag) == 1 )
+			swTag = tag;
+		else
+			swTag.clear();
+		return true;
+	}
+	return false;
+}
+
 bool SITiffReader::release()
 {
 	if ( m_tif )
@@ -368,12 +514,20 @@ bool SITiffReader::release()
 		return false;
 }
 cv::Mat SITiffReader::readframe(int framedir)
+{
+	cv::Mat frame;
+	if ( readframe(frame, framedir) )
+		return frame;
+	return cv::Mat();
+}
+
+bool SITiffReader::readframe(cv::Mat & frame, int framedir)
 {
 	if ( m_tif )
 	{
-		cv::Mat frame;
 		int framenum = framedir;
-		TIFFSetDirectory(m_tif, framenum);
+		if ( ! headerdata->gotoDirectory(m_tif, framenum) )
+			return false;
 		uint32 w = 0, h = 0;
 		uint16 photometric = 0;
 		if( TIFFGetField( m_tif, TIFFTAG_IMAGEWIDTH, &w ) && // normally = 512
@@ -416,7 +570,7 @@ cv::Mat SITiffReader::readframe(int framedir)
 
 	            // ********* return frame created here ***********
 
-	            frame = cv::Mat(h, w, cv_matrix_type);
+	            frame.create(h, w, cv_matrix_type);
 	            uchar * data = frame.ptr();
 
 	            for (int y = 0; y < m_imageheight; y+=tile_height0, data += frame.step*tile_height0)
@@ -440,7 +594,7 @@ cv::Mat SITiffReader::readframe(int framedir)
 	                    if ( !ok )
 	                    {
 	                    	close();
-	                    	return cv::Mat();
+	                    	return false;
 	                    }
 	                    for(int i = 0; i < tile_height; ++i)
 	                    {
@@ -451,11 +605,126 @@ cv::Mat SITiffReader::readframe(int framedir)
 	                }
 	            }
 
+	            return true;
 	        }
         }
-        return frame;
 	}
-	return cv::Mat();
+	return false;
+}
+
+bool SITiffReader::readRegion(cv::Mat & frame, const cv::Rect & region, int framedir)
+{
+	if ( ! m_tif || ! headerdata->gotoDirectory(m_tif, framedir) )
+		return false;
+	uint32 w = 0, h = 0;
+	if ( ! TIFFGetField(m_tif, TIFFTAG_IMAGEWIDTH, &w) || ! TIFFGetField(m_tif, TIFFTAG_IMAGELENGTH, &h) )
+		return false;
+	m_imagewidth = w;
+	m_imageheight = h;
+	const cv::Rect roi = region & cv::Rect(0, 0, w, h);
+	if ( roi.empty() )
+		return false;
+	frame.create(roi.height, roi.width, cv_matrix_type);
+	const size_t pixelBytes = frame.elemSize();
+	/*
+	Strips are just tiles as wide as the image so both are walked the
+	same way: every block touching the region is decoded and the overlap
+	copied out
+	*/
+	const bool tiled = TIFFIsTiled(m_tif);
+	uint32 blockWidth = w, blockHeight = h;
+	if ( tiled )
+	{
+		TIFFGetField(m_tif, TIFFTAG_TILEWIDTH, &blockWidth);
+		TIFFGetField(m_tif, TIFFTAG_TILELENGTH, &blockHeight);
+	}
+	else
+	{
+		TIFFGetField(m_tif, TIFFTAG_ROWSPERSTRIP, &blockHeight);
+		if ( blockHeight == 0 || blockHeight > h )
+			blockHeight = h;
+	}
+	if ( blockWidth == 0 || blockHeight == 0 )
+		return false;
+	const tmsize_t blockSize = tiled ? TIFFTileSize(m_tif) : TIFFStripSize(m_tif);
+	cv::AutoBuffer<uchar> _buffer(blockSize);
+	uchar * buffer = _buffer;
+	const uint32 firstRow = (roi.y / blockHeight) * blockHeight;
+	const uint32 firstCol = (roi.x / blockWidth) * blockWidth;
+	for (uint32 y = firstRow; y < (uint32)(roi.y + roi.height); y += blockHeight)
+	{
+		for (uint32 x = firstCol; x < (uint32)(roi.x + roi.width); x += blockWidth)
+		{
+			tmsize_t n = tiled ?
+				TIFFReadEncodedTile(m_tif, TIFFComputeTile(m_tif, x, y, 0, 0), buffer, blockSize) :
+				TIFFReadEncodedStrip(m_tif, TIFFComputeStrip(m_tif, y, 0), buffer, blockSize);
+			if ( n < 0 )
+				return false;
+			// the overlap of this block and the region
+			const int x0 = std::max<int>(x, roi.x), x1 = std::min<int>(x + blockWidth, roi.x + roi.width);
+			const int y0 = std::max<int>(y, roi.y), y1 = std::min<int>(y + blockHeight, roi.y + roi.height);
+			for (int row = y0; row < y1; ++row)
+			{
+				std::memcpy(frame.ptr(row - roi.y) + (x0 - roi.x) * pixelBytes,
+					buffer + ((row - y) * blockWidth + (x0 - x)) * pixelBytes,
+					(x1 - x0) * pixelBytes);
+			}
+		}
+	}
+	return true;
+}
+
+void SITiffReader::setImageSizeTags(std::string & tag, int height, int width)
+{
+	replaceValue(tag, headerdata->getLinesPerFrameString(), std::to_string(height));
+	replaceValue(tag, headerdata->getPixelsPerLineString(), std::to_string(width));
+}
+
+int SITiffReader::getChannelFor(int dirnum)
+{
+	const std::map<int, int> & saved = headerdata->getChanSaved();
+	if ( saved.empty() )
+		return 1;
+	// in the order they were saved
+	return std::next(saved.begin(), dirnum % saved.size())->second;
+}
+
+ChannelScaling SITiffReader::getChannelScaling(int chan, int depth)
+{
+	ChannelScaling scaling;
+	const std::map<int, int> offsets = headerdata->getChanOffsets();
+	const std::map<int, std::pair<int, int>> luts = headerdata->getChanLut();
+	auto offset = offsets.find(chan);
+	if ( offset != offsets.end() )
+		scaling.base = offset->second;
+	auto lut = luts.find(chan);
+	if ( lut != luts.end() && lut->second.second > lut->second.first )
+	{
+		const float top = depth == CV_8U ? 255.0f : 65535.0f;
+		scaling.base += lut->second.first;
+		scaling.scale = top / (lut->second.second - lut->second.first);
+	}
+	return scaling;
+}
+
+bool SITiffReader::convertFrame(const cv::Mat & src, cv::Mat & dst, const ChannelScaling & scaling, int depth)
+{
+	if ( src.type() != CV_16SC1 || ( depth != CV_8U && depth != CV_16U ) )
+		return false;
+	dst.create(src.rows, src.cols, CV_MAKETYPE(depth, 1));
+	for (int row = 0; row < src.rows; ++row)
+	{
+		if ( depth == CV_8U )
+			convert16sTo8u(src.ptr<int16_t>(row), dst.ptr<uint8_t>(row), src.cols, scaling.base, scaling.scale);
+		else
+			convert16sTo16u(src.ptr<int16_t>(row), dst.ptr<uint16_t>(row), src.cols, scaling.base, scaling.scale);
+	}
+	return true;
+}
+
+bool SITiffReader::convertFrame(const cv::Mat & src, cv::Mat & dst, int dirnum, int depth)
+{
+	return convertFrame(src, dst, getChannelScaling(getChannelFor(dirnum), depth), depth);
 }
 
 bool SITiffReader::close()
@@ -42,6 +42,11 @@
 
 #include "../include/bitstrm.hpp"
 
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
 namespace cv
 {
 
@@ -74,7 +79,9 @@ void  RBaseStream::allocate()
 RBaseStream::RBaseStream()
 {
     m_start = m_end = m_current = 0;
-    m_file = 0;
+    m_fd = -1;
+    m_map_size = 0;
+    m_block_pos = 0;
     m_block_size = BS_DEF_BLOCK_SIZE;
     m_is_opened = false;
     m_allocated = false;
@@ -92,19 +99,18 @@ void  RBaseStream::readBlock()
 {
     setPos( getPos() ); // normalize position
 
-    if( m_file == 0 )
+    if( m_fd < 0 )
     {
         if( m_block_pos == 0 && m_current < m_end )
             return;
         throw RBS_THROW_EOS;
     }
 
-    fseek( m_file, m_block_pos, SEEK_SET );
-    size_t readed = fread( m_start, 1, m_block_size, m_file );
-    m_end = m_start + readed;
-    m_current = m_start;
+    // one call with no seek, and whatever setPos left in m_current stays where it is in the block
+    ssize_t readed = pread( m_fd, m_start, m_block_size, (off_t)m_block_pos );
+    m_end = m_start + (readed > 0 ? readed : 0);
 
-    if( readed == 0 || m_current >= m_end )
+    if( readed <= 0 || m_current >= m_end )
         throw RBS_THROW_EOS;
 }
 
@@ -114,19 +120,22 @@ bool  RBaseStream::open( const String& filename )
     close();
     allocate();
 
-    m_file = fopen( filename.c_str(), "rb" );
-    if( m_file )
+    m_fd = ::open( filename.c_str(), O_RDONLY );
+    if( m_fd >= 0 )
     {
         m_is_opened = true;
+        m_block_pos = 0;
+        m_end = m_start; // nothing read yet
         setPos(0);
         readBlock();
     }
-    return m_file != 0;
+    return m_fd >= 0;
 }
 
 bool  RBaseStream::open( const Mat& buf )
 {
     close();
+    release();
     if( buf.empty() )
         return false;
     CV_Assert(buf.isContinuous());
@@ -139,12 +148,42 @@ bool  RBaseStream::open( const Mat& buf )
     return true;
 }
 
+bool  RBaseStream::openMapped( const String& filename )
+{
+    close();
+    release();
+
+    int fd = ::open( filename.c_str(), O_RDONLY );
+    if( fd < 0 )
+        return false;
+    struct stat st;
+    void* map = MAP_FAILED;
+    if( fstat( fd, &st ) == 0 && st.st_size > 0 && (uint64_t)st.st_size <= SIZE_MAX )
+        map = mmap( 0, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0 );
+    ::close( fd ); // the mapping keeps its own reference to the file
+    if( map == MAP_FAILED )
+        return false;
+
+    m_start = (uchar*)map;
+    m_map_size = (size_t)st.st_size;
+    m_end = m_start + m_map_size;
+    m_is_opened = true;
+    setPos(0);
+
+    return true;
+}
+
 void  RBaseStream::close()
 {
-    if( m_file )
+    if( m_fd >= 0 )
     {
-        fclose( m_file );
-        m_file = 0;
+        ::close( m_fd );
+        m_fd = -1;
+    }
+    if( m_map_size )
+    {
+        munmap( m_start, m_map_size );
+        m_map_size = 0;
     }
     m_is_opened = false;
     if( !m_allocated )
@@ -161,30 +200,46 @@ void  RBaseStream::release()
 }
 
 
-void  RBaseStream::setPos( int pos )
+void  RBaseStream::setBlockSize( int size )
+{
+    assert( !isOpened() && size > 0 );
+    if( size != m_block_size )
+    {
+        release();
+        m_block_size = size;
+    }
+}
+
+
+void  RBaseStream::setPos( int64_t pos )
 {
     assert( isOpened() && pos >= 0 );
 
-    if( !m_file )
+    if( m_fd < 0 )
     {
         m_current = m_start + pos;
         m_block_pos = 0;
         return;
     }
 
-    int offset = pos % m_block_size;
-    m_block_pos = pos - offset;
+    int64_t offset = pos % m_block_size;
+    if( pos - offset != m_block_pos )
+    {
+        // the buffer has a different block in it, so the next read fetches this one
+        m_block_pos = pos - offset;
+        m_end = m_start;
+    }
     m_current = m_start + offset;
 }
 
 
-int  RBaseStream::getPos()
+int64_t  RBaseStream::getPos()
 {
     assert( isOpened() );
-    return m_block_pos + (int)(m_current - m_start);
+    return m_block_pos + (m_current - m_start);
 }
 
-void  RBaseStream::skip( int bytes )
+void  RBaseStream::skip( int64_t bytes )
 {
     assert( bytes >= 0 );
     m_current += bytes;
@@ -328,6 +383,22 @@ int  RMByteStream::getDWord()
     return val;
 }
 
+
+uint64_t  RLByteStream::getQWord()
+{
+    uint64_t lo = (unsigned)getDWord();
+    uint64_t hi = (unsigned)getDWord();
+    return lo | (hi << 32);
+}
+
+
+uint64_t  RMByteStream::getQWord()
+{
+    uint64_t hi = (unsigned)getDWord();
+    uint64_t lo = (unsigned)getDWord();
+    return (hi << 32) | lo;
+}
+
 /////////////////////////// WBaseStream /////////////////////////////////
 
 // WBaseStream - base class for output streams
@@ -336,6 +407,7 @@ WBaseStream::WBaseStream()
     m_start = m_end = m_current = 0;
     m_file = 0;
     m_block_size = BS_DEF_BLOCK_SIZE;
+    m_block_pos = 0;
     m_is_opened = false;
     m_buf = 0;
 }
@@ -436,10 +508,21 @@ void  WBaseStream::release()
 }
 
 
-int  WBaseStream::getPos()
+void  WBaseStream::setBlockSize( int size )
+{
+    assert( !isOpened() && size > 0 );
+    if( size != m_block_size )
+    {
+        release();
+        m_block_size = size;
+    }
+}
+
+
+int64_t  WBaseStream::getPos()
 {
     assert( isOpened() );
-    return m_block_pos + (int)(m_current - m_start);
+    return m_block_pos + (m_current - m_start);
 }
 
 
@@ -530,6 +613,13 @@ void WLByteStream::putDWord( int val )
 }
 
 
+void WLByteStream::putQWord( uint64_t val )
+{
+    putDWord( (int)val );
+    putDWord( (int)(val >> 32) );
+}
+
+
 ///////////////////////////// WMByteStream ///////////////////////////////////
 
 WMByteStream::~WMByteStream()
@@ -580,4 +670,11 @@ void WMByteStream::putDWord( int val )
     }
 }
 
+
+void WMByteStream::putQWord( uint64_t val )
+{
+    putDWord( (int)(val >> 32) );
+    putDWord( (int)val );
+}
+
 }
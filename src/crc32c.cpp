@@ -0,0 +1,111 @@
+#include "../include/crc32c.h"
+
+#include <cstdio>
+#include <cstring>
+
+// the SSE4.2 version is built with a target attribute and only called if the CPU has it
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define HAVE_SSE42_DISPATCH
+#include <nmmintrin.h>
+#endif
+
+bool usingCRC32CInstruction()
+{
+#ifdef HAVE_SSE42_DISPATCH
+	static const bool sse42 = __builtin_cpu_supports("sse4.2");
+	return sse42;
+#else
+	return false;
+#endif
+}
+
+// reflected 0x1EDC6F41
+static const uint32_t polynomial = 0x82F63B78;
+
+namespace
+{
+// table[k][b] is the crc of byte b followed by k zero bytes
+struct Tables
+{
+	uint32_t table[8][256];
+	Tables()
+	{
+		for (uint32_t b = 0; b < 256; ++b)
+		{
+			uint32_t crc = b;
+			for (int bit = 0; bit < 8; ++bit)
+				crc = crc & 1 ? (crc >> 1) ^ polynomial : crc >> 1;
+			table[0][b] = crc;
+		}
+		for (uint32_t b = 0; b < 256; ++b)
+			for (int k = 1; k < 8; ++k)
+				table[k][b] = (table[k - 1][b] >> 8) ^ table[0][table[k - 1][b] & 0xff];
+	}
+};
+}
+
+static uint32_t crc32cTable(uint32_t crc, const unsigned char * p, std::size_t len)
+{
+	static const Tables tables;
+	const uint32_t (*t)[256] = tables.table;
+	for ( ; len >= 8; p += 8, len -= 8)
+	{
+		uint32_t lo, hi;
+		memcpy(&lo, p, 4);
+		memcpy(&hi, p + 4, 4);
+		// the slicing is written for little-endian words
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+		lo = __builtin_bswap32(lo);
+		hi = __builtin_bswap32(hi);
+#endif
+		lo ^= crc;
+		crc = t[7][lo & 0xff] ^ t[6][(lo >> 8) & 0xff] ^ t[5][(lo >> 16) & 0xff] ^ t[4][lo >> 24] ^
+			t[3][hi & 0xff] ^ t[2][(hi >> 8) & 0xff] ^ t[1][(hi >> 16) & 0xff] ^ t[0][hi >> 24];
+	}
+	for ( ; len > 0; ++p, --len)
+		crc = (crc >> 8) ^ t[0][(crc ^ *p) & 0xff];
+	return crc;
+}
+
+#ifdef HAVE_SSE42_DISPATCH
+__attribute__((target("sse4.2")))
+static uint32_t crc32cSSE42(uint32_t crc, const unsigned char * p, std::size_t len)
+{
+#ifdef __x86_64__
+	uint64_t crc64 = crc;
+	for ( ; len >= 8; p += 8, len -= 8)
+	{
+		uint64_t v;
+		memcpy(&v, p, 8);
+		crc64 = _mm_crc32_u64(crc64, v);
+	}
+	crc = (uint32_t)crc64;
+#endif
+	for ( ; len >= 4; p += 4, len -= 4)
+	{
+		uint32_t v;
+		memcpy(&v, p, 4);
+		crc = _mm_crc32_u32(crc, v);
+	}
+	for ( ; len > 0; ++p, --len)
+		crc = _mm_crc32_u8(crc, *p);
+	return crc;
+}
+#endif
+
+uint32_t crc32c(uint32_t crc, const void * data, std::size_t len)
+{
+	const unsigned char * p = static_cast<const unsigned char*>(data);
+#ifdef HAVE_SSE42_DISPATCH
+	if ( usingCRC32CInstruction() )
+		return ~crc32cSSE42(~crc, p, len);
+#endif
+	return ~crc32cTable(~crc, p, len);
+}
+
+std::string crc32cHex(uint32_t crc)
+{
+	char hex[9];
+	snprintf(hex, sizeof(hex), "%08x", crc);
+	return hex;
+}
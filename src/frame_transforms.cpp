@@ -0,0 +1,449 @@
+#include "../include/frame_transforms.h"
+#include "../include/simd_kernels.h"
+
+#include <cmath>
+#include <iomanip>
+#include <opencv2/imgproc.hpp>
+#include <sstream>
+
+/* -----------------------------------------------------------
+class TemporalBinning
+------------------------------------------------------------*/
+TemporalBinning::TemporalBinning(SITiffReader * reader, const SplitPlan * plan, unsigned int frames) :
+	m_reader(reader), m_plan(plan), m_frames(frames), m_bins(plan->numBins())
+{
+	if ( m_frames < 1 )
+		m_frames = 1;
+}
+
+void TemporalBinning::add(Bin & bin, FramePacket * packet)
+{
+	const cv::Mat & frame = packet->frame;
+	for (int row = 0; row < frame.rows; ++row)
+		accumulate16s(frame.ptr<int16_t>(row), bin.sum.ptr<int32_t>(row), frame.cols);
+	++bin.count;
+	FrameTimes times;
+	if ( m_reader->parseFrameTimes(packet->imDescTag, times) )
+	{
+		bin.timeSum += times.timestamp;
+		++bin.timeCount;
+	}
+}
+
+void TemporalBinning::process(FramePacket * packet, std::vector<FramePacket*> & out)
+{
+	if ( packet->frame.type() != CV_16SC1 )
+	{
+		out.push_back(packet);
+		return;
+	}
+	Bin & bin = m_bins[m_plan->binFor(packet->dirnum)];
+	// a bin never carries on into the next part
+	if ( bin.carrier && bin.carrier->part != packet->part )
+		release(bin, out);
+	if ( bin.carrier && ( bin.sum.rows != packet->frame.rows || bin.sum.cols != packet->frame.cols ) )
+	{
+		std::cout << "Frame " << packet->dirnum << " is a different size to the rest of its bin" << std::endl;
+		release(bin, out);
+	}
+	if ( ! bin.carrier )
+	{
+		bin.carrier = packet;
+		bin.sum.create(packet->frame.size(), CV_32SC1);
+		bin.sum.setTo(0);
+		bin.count = 0;
+		bin.timeSum = 0;
+		bin.timeCount = 0;
+		add(bin, packet);
+	}
+	else
+	{
+		add(bin, packet);
+		// the writer just recycles it
+		packet->skip = true;
+		out.push_back(packet);
+	}
+	if ( bin.count == m_frames )
+		release(bin, out);
+}
+
+void TemporalBinning::release(Bin & bin, std::vector<FramePacket*> & out)
+{
+	FramePacket * packet = bin.carrier;
+	cv::Mat & frame = packet->frame;
+	for (int row = 0; row < frame.rows; ++row)
+		average32s(bin.sum.ptr<int32_t>(row), frame.ptr<int16_t>(row), frame.cols, bin.count);
+	if ( bin.timeCount > 0 )
+	{
+		std::ostringstream ts;
+		ts << std::fixed << std::setprecision(6) << bin.timeSum / bin.timeCount;
+		replaceValue(packet->imDescTag, m_reader->getFrameTimeStampString(), ts.str());
+		// (version 0 files have a copy of the ImageDescription as the Software tag)
+		replaceValue(packet->swTag, m_reader->getFrameTimeStampString(), ts.str());
+	}
+	out.push_back(packet);
+	bin.carrier = nullptr;
+}
+
+void TemporalBinning::flush(std::vector<FramePacket*> & out)
+{
+	for ( auto & bin : m_bins )
+	{
+		if ( bin.carrier )
+			release(bin, out);
+	}
+}
+
+/* -----------------------------------------------------------
+class SpatialBinning
+------------------------------------------------------------*/
+SpatialBinning::SpatialBinning(SITiffReader * reader, int factor) :
+	m_reader(reader), m_factor(factor == 4 ? 4 : 2) {}
+
+void SpatialBinning::process(FramePacket * packet, std::vector<FramePacket*> & out)
+{
+	out.push_back(packet);
+	const cv::Mat & frame = packet->frame;
+	if ( frame.type() != CV_16SC1 || frame.rows < m_factor || frame.cols < m_factor )
+		return;
+	cv::Mat & binned = m_binned[packet];
+	binned.create(frame.rows / m_factor, frame.cols / m_factor, CV_16SC1);
+	const std::size_t step = frame.step1();
+	for (int row = 0; row < binned.rows; ++row)
+		bin16s(frame.ptr<int16_t>(row * m_factor), step, m_factor, binned.ptr<int16_t>(row), binned.cols);
+	packet->frame = binned;
+	m_reader->setImageSizeTags(packet->swTag, binned.rows, binned.cols);
+	m_reader->setImageSizeTags(packet->imDescTag, binned.rows, binned.cols);
+}
+
+/* -----------------------------------------------------------
+class DisplayConversion
+------------------------------------------------------------*/
+DisplayConversion::DisplayConversion(SITiffReader * reader, int depth) :
+	m_reader(reader), m_depth(depth == CV_16U ? CV_16U : CV_8U)
+{
+	for ( auto & chan : m_reader->getSavedChans() )
+		m_scaling[chan.second] = m_reader->getChannelScaling(chan.second, m_depth);
+}
+
+void DisplayConversion::process(FramePacket * packet, std::vector<FramePacket*> & out)
+{
+	out.push_back(packet);
+	if ( packet->frame.type() != CV_16SC1 )
+		return;
+	cv::Mat & converted = m_converted[packet];
+	if ( SITiffReader::convertFrame(packet->frame, converted, m_scaling[m_reader->getChannelFor(packet->dirnum)], m_depth) )
+		packet->frame = converted;
+}
+
+/* -----------------------------------------------------------
+class Projections
+------------------------------------------------------------*/
+Projections::Projections(unsigned int threads)
+{
+	if ( threads < 1 )
+		threads = 1;
+	// enough to keep every worker busy while the oldest frame finishes
+	m_maxHeld = 2 * threads;
+	for (unsigned int i = 0; i < threads; ++i)
+	{
+		m_workers.emplace_back(new Worker);
+		Worker * worker = m_workers.back().get();
+		worker->jobs.reset(new SPSCQueue<FramePacket*>(m_maxHeld));
+		worker->thread = std::thread(&Projections::work, this, worker);
+	}
+}
+
+Projections::~Projections()
+{
+	for ( auto & worker : m_workers )
+	{
+		worker->jobs->waitPush(nullptr);
+		worker->thread.join();
+	}
+}
+
+void Projections::work(Worker * worker)
+{
+	FramePacket * packet;
+	while ( true )
+	{
+		worker->jobs->waitPop(packet);
+		if ( ! packet )
+			break;
+		worker->parts[packet->part].add(packet->frame);
+		worker->done.fetch_add(1, std::memory_order_release);
+	}
+}
+
+void Projections::Accumulator::add(const cv::Mat & frame)
+{
+	if ( count == 0 )
+	{
+		sum = cv::Mat::zeros(frame.rows, frame.cols, CV_64FC1);
+		sumsq = cv::Mat::zeros(frame.rows, frame.cols, CV_64FC1);
+		max.create(frame.rows, frame.cols, CV_16SC1);
+		max.setTo(INT16_MIN);
+	}
+	else if ( frame.rows != sum.rows || frame.cols != sum.cols )
+		return;
+	for (int row = 0; row < frame.rows; ++row)
+		accumulateMoments16s(frame.ptr<int16_t>(row), sum.ptr<double>(row), sumsq.ptr<double>(row),
+			max.ptr<int16_t>(row), frame.cols);
+	++count;
+}
+
+void Projections::Accumulator::merge(const Accumulator & other)
+{
+	if ( other.count == 0 )
+		return;
+	if ( count == 0 )
+	{
+		*this = other;
+		return;
+	}
+	if ( other.sum.rows != sum.rows || other.sum.cols != sum.cols )
+		return;
+	for (int row = 0; row < sum.rows; ++row)
+	{
+		double * s = sum.ptr<double>(row), * s2 = sumsq.ptr<double>(row);
+		int16_t * m = max.ptr<int16_t>(row);
+		const double * os = other.sum.ptr<double>(row), * os2 = other.sumsq.ptr<double>(row);
+		const int16_t * om = other.max.ptr<int16_t>(row);
+		for (int col = 0; col < sum.cols; ++col)
+		{
+			s[col] += os[col];
+			s2[col] += os2[col];
+			m[col] = std::max(m[col], om[col]);
+		}
+	}
+	count += other.count;
+}
+
+void Projections::release(std::vector<FramePacket*> & out, bool wait)
+{
+	while ( ! m_held.empty() )
+	{
+		Held & held = m_held.front();
+		if ( held.worker )
+		{
+			bool finished = held.worker->done.load(std::memory_order_acquire) > held.job;
+			if ( ! finished && ! wait )
+				break;
+			while ( ! finished )
+			{
+				std::this_thread::yield();
+				finished = held.worker->done.load(std::memory_order_acquire) > held.job;
+			}
+		}
+		out.push_back(held.packet);
+		m_held.pop_front();
+	}
+}
+
+void Projections::process(FramePacket * packet, std::vector<FramePacket*> & out)
+{
+	if ( packet->frame.type() != CV_16SC1 )
+	{
+		// still has to wait its turn behind anything held
+		m_held.push_back({packet, nullptr, 0});
+		release(out, false);
+		return;
+	}
+	const int stream = packet->partInfo->stream;
+	auto current = m_currentPart.find(stream);
+	if ( current != m_currentPart.end() && current->second != packet->part )
+		finishPart(current->second, out);
+	m_currentPart[stream] = packet->part;
+	m_partInfo[packet->part] = packet->partInfo;
+	// make room by waiting for the oldest
+	while ( m_held.size() >= m_maxHeld )
+	{
+		std::vector<FramePacket*> released;
+		release(released, false);
+		if ( released.empty() )
+			std::this_thread::yield();
+		out.insert(out.end(), released.begin(), released.end());
+	}
+	Worker * worker = m_workers[m_nextWorker++ % m_workers.size()].get();
+	m_held.push_back({packet, worker, worker->submitted++});
+	worker->jobs->waitPush(packet);
+	release(out, false);
+}
+
+void Projections::finishPart(int part, std::vector<FramePacket*> & out)
+{
+	// every frame has to be in before the partial sums can be merged
+	release(out, true);
+	Accumulator total;
+	for ( auto & worker : m_workers )
+	{
+		auto partial = worker->parts.find(part);
+		if ( partial != worker->parts.end() )
+		{
+			total.merge(partial->second);
+			worker->parts.erase(partial);
+		}
+	}
+	const PartPlan * info = m_partInfo[part];
+	m_partInfo.erase(part);
+	if ( total.count == 0 || ! info )
+		return;
+	cv::Mat mean(total.sum.rows, total.sum.cols, CV_32FC1);
+	cv::Mat max(total.sum.rows, total.sum.cols, CV_32FC1);
+	cv::Mat stddev(total.sum.rows, total.sum.cols, CV_32FC1);
+	for (int row = 0; row < mean.rows; ++row)
+	{
+		const double * s = total.sum.ptr<double>(row), * s2 = total.sumsq.ptr<double>(row);
+		const int16_t * m = total.max.ptr<int16_t>(row);
+		for (int col = 0; col < mean.cols; ++col)
+		{
+			double mu = s[col] / total.count;
+			mean.ptr<float>(row)[col] = (float)mu;
+			max.ptr<float>(row)[col] = m[col];
+			stddev.ptr<float>(row)[col] = (float)std::sqrt(std::max(0.0, s2[col] / total.count - mu * mu));
+		}
+	}
+	// next to the part: base_part0.tif -> base_part0_mean.tif etc
+	std::string base = info->filename;
+	std::size_t dot = base.rfind('.');
+	std::size_t slash = base.rfind('/');
+	if ( dot != std::string::npos && ( slash == std::string::npos || dot > slash ) )
+		base = base.substr(0, dot);
+	const std::pair<const char*, cv::Mat*> projections[] = { {"_mean.tif", &mean}, {"_max.tif", &max}, {"_std.tif", &stddev} };
+	for ( auto & projection : projections )
+	{
+		cv::TiffWriter writer;
+		std::string filename = base + projection.first;
+		if ( ! writer.open(filename, false) || ! writer.write(*projection.second, std::vector<int>()) || ! writer.close() )
+			std::cout << "Failed to write the projection " << filename << std::endl;
+	}
+	++m_projected;
+}
+
+void Projections::flush(std::vector<FramePacket*> & out)
+{
+	release(out, true);
+	for ( auto & current : m_currentPart )
+		finishPart(current.second, out);
+	m_currentPart.clear();
+}
+
+/* -----------------------------------------------------------
+class MotionCorrection
+------------------------------------------------------------*/
+MotionCorrection::MotionCorrection(SITiffReader * reader, unsigned int referenceFrames, const std::string & shiftsFile) :
+	m_referenceFrames(std::max(1u, referenceFrames)), m_shifts(shiftsFile)
+{
+	m_cycle = std::max<std::size_t>(1, reader->getSavedChans().size()) * std::max(1, reader->getNumPlanes());
+	m_batch = 2 * std::max(1, cv::getNumThreads());
+	if ( ! m_shifts )
+		std::cout << "Could not open " << shiftsFile << " for the motion correction shifts" << std::endl;
+	m_shifts << "frame,x,y,response" << std::endl;
+}
+
+void MotionCorrection::process(FramePacket * packet, std::vector<FramePacket*> & out)
+{
+	m_held.push_back(packet);
+	if ( packet->frame.type() == CV_16SC1 )
+	{
+		Reference & reference = m_references[keyFor(packet)];
+		if ( ! reference.ready )
+		{
+			cv::Mat frame;
+			packet->frame.convertTo(frame, CV_32F);
+			if ( reference.count == 0 )
+				reference.sum = frame;
+			else if ( frame.rows == reference.sum.rows && frame.cols == reference.sum.cols )
+				cv::accumulate(frame, reference.sum);
+			if ( ++reference.count == m_referenceFrames )
+				finishReference(reference);
+		}
+	}
+	correct(out, false);
+}
+
+void MotionCorrection::finishReference(Reference & reference)
+{
+	reference.sum.convertTo(reference.sum, CV_32F, 1.0 / reference.count);
+	reference.ready = true;
+	if ( m_window.rows != reference.sum.rows || m_window.cols != reference.sum.cols )
+		cv::createHanningWindow(m_window, reference.sum.size(), CV_32F);
+}
+
+void MotionCorrection::correct(std::vector<FramePacket*> & out, bool all)
+{
+	// frames go on in order so stop at the first one still waiting for its reference
+	std::size_t ready = 0;
+	for ( ; ready < m_held.size(); ++ready)
+	{
+		FramePacket * packet = m_held[ready];
+		if ( packet->frame.type() != CV_16SC1 )
+			continue;
+		auto reference = m_references.find(keyFor(packet));
+		if ( reference == m_references.end() || ! reference->second.ready )
+			break;
+	}
+	if ( ready == 0 || ( ready < m_batch && ! all ) )
+		return;
+	std::vector<FramePacket*> batch(m_held.begin(), m_held.begin() + ready);
+	std::vector<cv::Point2d> shifts(ready);
+	std::vector<double> responses(ready, 0);
+	// the buffers are found (or made) here as the map can't be touched from the workers
+	std::vector<cv::Mat*> corrected(ready, nullptr);
+	for (std::size_t i = 0; i < ready; ++i)
+	{
+		if ( batch[i]->frame.type() == CV_16SC1 )
+			corrected[i] = &m_corrected[batch[i]];
+	}
+	cv::parallel_for_(cv::Range(0, ready), [&](const cv::Range & range)
+	{
+		for (int i = range.start; i < range.end; ++i)
+		{
+			FramePacket * packet = batch[i];
+			if ( ! corrected[i] )
+				continue;
+			const cv::Mat & reference = m_references.at(keyFor(packet)).sum;
+			if ( packet->frame.rows != reference.rows || packet->frame.cols != reference.cols )
+			{
+				corrected[i] = nullptr;
+				continue;
+			}
+			cv::Mat frame;
+			packet->frame.convertTo(frame, CV_32F);
+			shifts[i] = cv::phaseCorrelate(reference, frame, m_window, &responses[i]);
+			cv::Mat shift(2, 3, CV_64FC1);
+			shift.at<double>(0, 0) = 1;
+			shift.at<double>(0, 1) = 0;
+			shift.at<double>(0, 2) = -shifts[i].x;
+			shift.at<double>(1, 0) = 0;
+			shift.at<double>(1, 1) = 1;
+			shift.at<double>(1, 2) = -shifts[i].y;
+			cv::warpAffine(packet->frame, *corrected[i], shift, packet->frame.size(),
+				cv::INTER_LINEAR, cv::BORDER_CONSTANT, cv::Scalar(0));
+		}
+	});
+	for (std::size_t i = 0; i < ready; ++i)
+	{
+		FramePacket * packet = batch[i];
+		if ( corrected[i] )
+		{
+			packet->frame = *corrected[i];
+			m_shifts << packet->dirnum << "," << -shifts[i].x << "," << -shifts[i].y << "," << responses[i] << "\n";
+		}
+		out.push_back(packet);
+	}
+	m_held.erase(m_held.begin(), m_held.begin() + ready);
+}
+
+void MotionCorrection::flush(std::vector<FramePacket*> & out)
+{
+	// short files might not have had enough frames for a full reference
+	for ( auto & reference : m_references )
+	{
+		if ( ! reference.second.ready && reference.second.count > 0 )
+			finishReference(reference.second);
+	}
+	correct(out, true);
+	m_shifts.flush();
+}
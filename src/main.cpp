@@ -1,16 +1,26 @@
 #include <cctype>
 #include <cstdio>
 #include <cstdlib>
+#include <cstring>
 #include <unistd.h>
 #include <getopt.h>
 
 /* Flag set by '--verbose' */
 static int verbose_flag;
 
+#include <algorithm>
 #include <memory>
+#include <thread>
 #include <boost/filesystem.hpp>
 #include "../include/ScanImageTiff.h"
 #include "../include/write_tiff.h"
+#include "../include/split_plan.h"
+#include "../include/split_pipeline.h"
+#include "../include/frame_transforms.h"
+#include "../include/tiff_merge.h"
+#include "../include/tiff_verify.h"
+#include "../include/split_journal.h"
+#include "../include/plan_report.h"
 
 void printhelp() {
 	std::cout << "\nA command-line utility for splitting tiff files recorded with ScanImage.\n";
@@ -18,7 +28,31 @@ void printhelp() {
 	std::cout << "Usage:\n";
 	std::cout << "\t-f :  required - the input tiff file to split\n";
 	std::cout << "\t-c :  chunks - the number of frames (default 5000) in each part of the split files\n";
-	std::cout << "\t-s :  the output file base name\n";
+	std::cout << "\t-b :  bytes - split by size instead, each part at most this big (e.g. 4G, 500M, 1048576)\n";
+	std::cout << "\t      (with -z every frame counts as the most it could compress to, so parts usually come out smaller)\n";
+	std::cout << "\t-t :  time - split by acquisition time instead, a new part every this many seconds\n";
+	std::cout << "\t-g :  triggers - start a new part at each acquisition trigger or next file marker (can be used with -t)\n";
+	std::cout << "\t-z :  compress the output with lzw, deflate or packbits (default none)\n";
+	std::cout << "\t-a :  average - write the mean of every this many frames of each channel and plane\n";
+	std::cout << "\t-r :  crop - only keep the region x,y,width,height of each frame (e.g. 0,128,512,64)\n";
+	std::cout << "\t-k :  motion correct each frame against the mean of its channel's first this many frames;\n";
+	std::cout << "\t      the shifts are saved to <output base>_shifts.csv\n";
+	std::cout << "\t-p :  projections - also write mean, max and std projections of each part (e.g. _part0_mean.tif)\n";
+	std::cout << "\t-u :  unsigned - convert to 8 or 16-bit for viewing using the channel offsets and LUTs (8 or 16)\n";
+	std::cout << "\t-x :  bin - bin each frame 2x2 or 4x4 (2 or 4)\n";
+	std::cout << "\t-w :  raw - write each part as a flat binary .bin file (for mmap) with a .json sidecar instead of a tiff\n";
+	std::cout << "\t-i :  deinterleave - write each channel, plane or both to separate files (channels, planes or both)\n";
+	std::cout << "\t-s :  the output file base name, or - to stream everything to stdout as a single tiff\n";
+	std::cout << "\t      (or with -w as raw frames, each behind a 48 byte header - see RawFrameHeader)\n";
+	std::cout << "\t-e :  checksums - save CRC32C digests of every frame and part to <output base>_manifest.json\n";
+	std::cout << "\t-d :  direct - write the output with O_DIRECT, bypassing the page cache\n";
+	std::cout << "\t-n :  dry run - only print the parts the split would write, their sizes, frames and timestamps,\n";
+	std::cout << "\t      as text or json (to stdout, everything else goes to stderr); no pixels are read\n";
+	std::cout << "\t-j :  resume - carry on an interrupted split (run the same command again with -j), skipping\n";
+	std::cout << "\t      the parts recorded in <output base>.journal that are still intact\n";
+	std::cout << "\t-m :  merge - join the tiff files listed after the options into the single file given by -s\n";
+	std::cout << "\t-v :  verify - check the tiff files listed after the options (or <output base>_part0.tif, _part1.tif...)\n";
+	std::cout << "\t      hold the same frames, tags and pixels as -f; only for splits without -a, -r, -k, -u, -x or -i\n";
 	std::cout << "\t-h :  prints this message\n";
 	std::cout << "\n\tExample:\n";
 	std::cout << "\n\tTiffSplitter -f /home/robin/my_big_file.tif -c 10000 -s /home/robin/my_smaller_tiffs\n";
@@ -34,14 +68,82 @@ void printhelp() {
 	std::cout << "\t\tmy_big_file_part1.tif\n";
 	std::cout << "\t\tmy_big_file_part2.tif\n";
 	std::cout << "\t\tetc...\n\n";
+	std::cout << "\tWith -b 4G instead of -c each file holds as many frames as fit in 4GB.\n";
+	std::cout << "\n\tWith -i channels the frames of each channel go to their own files which are split separately:\n";
+	std::cout << "\t\tmy_smaller_tiffs_chan1_part0.tif\n";
+	std::cout << "\t\tmy_smaller_tiffs_chan2_part0.tif\n";
+	std::cout << "\t\tetc...\n\n";
+	std::cout << "\tTo put them back together again:\n";
+	std::cout << "\n\tTiffSplitter -m -s /home/robin/my_big_file.tif /home/robin/my_smaller_tiffs_part*.tif\n\n";
+	std::cout << "\tTo check they were split properly:\n";
+	std::cout << "\n\tTiffSplitter -v -f /home/robin/my_big_file.tif -s /home/robin/my_smaller_tiffs\n\n";
 	exit(0);
 }
 
+// A byte count with an optional K, M, G or T suffix (powers of 1024); 0 if it doesn't parse
+static uint64 parseBytes(const char * arg)
+{
+	char * end;
+	unsigned long long value = strtoull(arg, &end, 10);
+	switch ( toupper(*end) )
+	{
+		case 'T': value <<= 10;
+		case 'G': value <<= 10;
+		case 'M': value <<= 10;
+		case 'K': value <<= 10; ++end;
+		case '\0': break;
+		default: return 0;
+	}
+	if ( *end == 'B' || *end == 'b' )
+		++end;
+	return *end == '\0' ? value : 0;
+}
+
+// libtiff compression scheme from its name; -1 if it's not one we write
+static int parseCompression(const std::string & name)
+{
+	if ( name == "none" )
+		return COMPRESSION_NONE;
+	if ( name == "lzw" )
+		return COMPRESSION_LZW;
+	if ( name == "deflate" || name == "zip" )
+		return COMPRESSION_ADOBE_DEFLATE;
+	if ( name == "packbits" )
+		return COMPRESSION_PACKBITS;
+	return -1;
+}
+
 int main(int argc, char **argv)
 {
 	std::string inputfile;
 	std::string outputfile_base;
 	int chunk_size = 5000;
+	uint64 max_bytes = 0;
+	int compression = COMPRESSION_NONE;
+	bool direct_io = false;
+	double seconds = 0;
+	bool on_triggers = false;
+	bool by_channel = false;
+	bool by_plane = false;
+	bool merge = false;
+	bool verify = false;
+	bool resume = false;
+	std::string dry_run; // text or json
+	int average = 1;
+	int bin = 1;
+	cv::Rect crop;
+	int display_bits = 0;
+	bool projections = false;
+	int reference_frames = 0;
+	bool raw = false;
+	bool checksums = false;
+
+	// what the journal identifies the split by, as getopt shuffles argv
+	std::string command;
+	for ( int i = 1; i < argc; ++i ) {
+		if ( strcmp(argv[i], "-j") != 0 && strcmp(argv[i], "--resume") != 0 )
+			command += std::string(command.empty() ? "" : " ") + argv[i];
+	}
 
 	int c;
 
@@ -54,13 +156,31 @@ int main(int argc, char **argv)
 			They are distinguished by their indices*/
 			{"help", no_argument, 0, 'h'},
 			{"file", required_argument, 0, 'f'},
-			{"chunks", no_argument, 0, 'c'},
+			{"chunks", required_argument, 0, 'c'},
 			{"savefile", required_argument, 0, 's'},
+			{"bytes", required_argument, 0, 'b'},
+			{"time", required_argument, 0, 't'},
+			{"triggers", no_argument, 0, 'g'},
+			{"compress", required_argument, 0, 'z'},
+			{"deinterleave", required_argument, 0, 'i'},
+			{"average", required_argument, 0, 'a'},
+			{"bin", required_argument, 0, 'x'},
+			{"crop", required_argument, 0, 'r'},
+			{"unsigned", required_argument, 0, 'u'},
+			{"projections", no_argument, 0, 'p'},
+			{"motion", required_argument, 0, 'k'},
+			{"raw", no_argument, 0, 'w'},
+			{"checksum", no_argument, 0, 'e'},
+			{"direct", no_argument, 0, 'd'},
+			{"merge", no_argument, 0, 'm'},
+			{"verify", no_argument, 0, 'v'},
+			{"resume", no_argument, 0, 'j'},
+			{"dry-run", required_argument, 0, 'n'},
 			{0, 0, 0, 0}
 		};
 		/* getopt_long stores the option index here */
 		int option_index = 0;
-		c = getopt_long(argc, argv, "hf:c:s:", long_options, &option_index);
+		c = getopt_long(argc, argv, "hf:c:b:t:gz:i:a:x:r:u:pk:wes:dmvjn:", long_options, &option_index);
 		/* Detect the end of the options */
 		if ( c == -1 )
 			break;
@@ -78,9 +198,104 @@ int main(int argc, char **argv)
 			case 'c':
 				chunk_size = atoi(optarg);
 				break;
+			case 'b':
+				max_bytes = parseBytes(optarg);
+				if ( max_bytes == 0 ) {
+					std::cout << "Could not understand the size " << optarg << ", so exiting\n";
+					exit(1);
+				}
+				break;
+			case 't':
+				seconds = atof(optarg);
+				if ( seconds <= 0 ) {
+					std::cout << "The time per part has to be more than 0 seconds, so exiting\n";
+					exit(1);
+				}
+				break;
+			case 'g':
+				on_triggers = true;
+				break;
+			case 'z':
+				compression = parseCompression(optarg);
+				if ( compression < 0 ) {
+					std::cout << "Unknown compression " << optarg << ", so exiting\n";
+					exit(1);
+				}
+				break;
+			case 'i':
+				by_channel = strcmp(optarg, "channels") == 0 || strcmp(optarg, "both") == 0;
+				by_plane = strcmp(optarg, "planes") == 0 || strcmp(optarg, "both") == 0;
+				if ( ! by_channel && ! by_plane ) {
+					std::cout << "Deinterleave by channels, planes or both, not " << optarg << ", so exiting\n";
+					exit(1);
+				}
+				break;
+			case 'a':
+				average = atoi(optarg);
+				if ( average < 1 ) {
+					std::cout << "Can only average over 1 or more frames, so exiting\n";
+					exit(1);
+				}
+				break;
+			case 'x':
+				bin = atoi(optarg);
+				if ( bin != 2 && bin != 4 ) {
+					std::cout << "Frames can be binned 2x2 or 4x4, not " << optarg << ", so exiting\n";
+					exit(1);
+				}
+				break;
+			case 'r':
+				if ( sscanf(optarg, "%d,%d,%d,%d", &crop.x, &crop.y, &crop.width, &crop.height) != 4 ||
+					crop.x < 0 || crop.y < 0 || crop.empty() ) {
+					std::cout << "The crop should be x,y,width,height, not " << optarg << ", so exiting\n";
+					exit(1);
+				}
+				break;
+			case 'u':
+				display_bits = atoi(optarg);
+				if ( display_bits != 8 && display_bits != 16 ) {
+					std::cout << "Can convert to 8 or 16 bits, not " << optarg << ", so exiting\n";
+					exit(1);
+				}
+				break;
+			case 'p':
+				projections = true;
+				break;
+			case 'k':
+				reference_frames = atoi(optarg);
+				if ( reference_frames < 1 ) {
+					std::cout << "The motion correction reference needs at least 1 frame, so exiting\n";
+					exit(1);
+				}
+				break;
+			case 'w':
+				raw = true;
+				break;
+			case 'e':
+				checksums = true;
+				break;
 			case 's':
 				outputfile_base = std::string(optarg);
 				break;
+			case 'd':
+				direct_io = true;
+				break;
+			case 'm':
+				merge = true;
+				break;
+			case 'v':
+				verify = true;
+				break;
+			case 'j':
+				resume = true;
+				break;
+			case 'n':
+				dry_run = std::string(optarg);
+				if ( dry_run != "text" && dry_run != "json" ) {
+					std::cout << "The dry run can only be printed as text or json, so exiting\n";
+					exit(1);
+				}
+				break;
 			default:
 				abort();
 		}
@@ -100,6 +315,57 @@ int main(int argc, char **argv)
 	// 	while ( optind < argc )
 	// 		std::cout << argv[optind++] << std::endl;
 	// }
+	// a json plan goes to stdout on its own, like an output stream
+	std::ostream plan_out(std::cout.rdbuf());
+	if ( dry_run == "json" )
+		std::cout.rdbuf(std::cerr.rdbuf());
+	// the output stream gets stdout to itself so the messages all go to stderr
+	const bool to_stdout = outputfile_base == "-";
+	if ( to_stdout ) {
+		std::cout.rdbuf(std::cerr.rdbuf());
+		if ( merge || verify ) {
+			std::cout << "Merging and verifying can't use stdout, so exiting\n";
+			exit(1);
+		}
+		if ( isatty(STDOUT_FILENO) && dry_run.empty() ) {
+			std::cout << "Not writing binary output to a terminal, so exiting\n";
+			exit(1);
+		}
+		if ( max_bytes > 0 || seconds > 0 || on_triggers ) {
+			std::cout << "The output stream isn't split into parts so -b, -t and -g can't be used with it, so exiting\n";
+			exit(1);
+		}
+		if ( ( by_channel || by_plane ) && ! raw ) {
+			std::cout << "Only raw frames (-w) can be deinterleaved onto the output stream, so exiting\n";
+			exit(1);
+		}
+		// anything else written (the shifts, projections) is named after the input
+		outputfile_base.clear();
+	}
+	// the motion reference and the manifest both need the split from the start
+	if ( resume && ( to_stdout || seconds > 0 || on_triggers || reference_frames > 0 || checksums ) ) {
+		std::cout << "Only splits into files planned up front without -k or -e can be resumed, so exiting\n";
+		exit(1);
+	}
+	if ( merge ) {
+		// the files to join are -f (if given) then everything after the options
+		if ( outputfile_base.empty() ) {
+			std::cout << "Merging needs an output file (-s), so exiting\n";
+			exit(1);
+		}
+		TiffMerger merger(outputfile_base);
+		merger.setDirectIO(direct_io);
+		if ( ! inputfile.empty() )
+			merger.addInput(inputfile);
+		for ( ; optind < argc; ++optind )
+			merger.addInput(argv[optind]);
+		if ( ! merger.run() ) {
+			std::cout << "Merging failed, so exiting\n";
+			exit(1);
+		}
+		std::cout << "Wrote " << merger.getFramesWritten() << " frames to " << outputfile_base << std::endl;
+		exit(0);
+	}
 	// Check the input file exists
 	if ( ! boost::filesystem::exists(inputfile) ) {
 		std::cout << "Input tiff file does not exist, so exiting\n";
@@ -107,12 +373,37 @@ int main(int argc, char **argv)
 	}
 	// Create an outfile base name if one hasn't been supplied
 	if ( outputfile_base.empty() ) {
-		std::cout << "Output file is empty so naming files after input file like" << std::endl;
 		std::vector<std::string> base;
 		split(inputfile, '.', base);
-		std::cout << (base[0] + "_part0.tiff") << std::endl;
+		if ( ! to_stdout && ! verify ) {
+			std::cout << "Output file is empty so naming files after input file like" << std::endl;
+			std::cout << (base[0] + "_part0.tiff") << std::endl;
+		}
 		outputfile_base = base[0];
 	}
+	if ( verify ) {
+		// the parts are what's after the options or, failing that, whatever a plain split would have called them
+		TiffVerifier verifier(inputfile);
+		verifier.setThreads(std::thread::hardware_concurrency());
+		SITiffReader source(inputfile);
+		if ( source.open() ) {
+			verifier.setSourceVersion(source.getVersion());
+			source.close();
+		}
+		if ( optind < argc ) {
+			for ( ; optind < argc; ++optind )
+				verifier.addPart(argv[optind]);
+		}
+		else {
+			for ( int part = 0; boost::filesystem::exists(outputfile_base + "_part" + std::to_string(part) + ".tif"); ++part )
+				verifier.addPart(outputfile_base + "_part" + std::to_string(part) + ".tif");
+		}
+		if ( ! verifier.run() ) {
+			std::cout << "Verification failed\n";
+			exit(1);
+		}
+		exit(0);
+	}
 	// Create a file reader and count the number of directories (frames) in the tiff file
 	// NB the counting could be skipped
 	std::unique_ptr<SITiffReader> reader = std::make_unique<SITiffReader>(inputfile);
@@ -120,39 +411,139 @@ int main(int argc, char **argv)
 		std::cout << "Could not open tiff file, so exiting\n";
 		exit(1);
 	}
-	int count = 0;
+	// libtiff 4.5 on (see ScanImageTiff.h) counts past 65535 directories, so every frame is split
+	std::cout << "Reading the directories in this tiff file (may take a while)..." << std::endl;
+	std::vector<DirInfo> dirs;
+	int count = reader->scanDirectories(dirs);
+	std::cout << "There are " << count << " frames in this tiff file" << std::endl;
+	if ( ! crop.empty() && ! dirs.empty() && ( crop & cv::Rect(0, 0, dirs[0].width, dirs[0].height) ).empty() ) {
+		std::cout << "The crop is outside the " << dirs[0].width << "x" << dirs[0].height << " frame, so exiting\n";
+		exit(1);
+	}
 	/*
-	libtiff has a maximum limit of 65535 frames per tiff file and throws an error if the number
-	of frames is equal to or greater than this number - need to account for that here and sensibly
-	traverse the file and save it...
+	Work out which frames go in which file and how big each file will be
+	before writing anything so the space can be reserved up front
 	*/
-	std::cout << "Counting directories in this tiff file (may take a while)..." << std::endl;
-	reader->countDirectories(count);
-	if ( count >= 65535) {
-		std::cout << "\nWARNING: This file contains more than 65535 frames.\n";
-		std::cout << "This means I can only save the first 65535 frames," << std::endl;
-		std::cout << "i.e. the total number of frames from all chunks will equal 65535" << std::endl;
+	SplitPlan plan(outputfile_base);
+	plan.setCompression(compression);
+	// the channel map, plane count, offsets and LUTs come from the header of the first frame
+	if ( by_channel || by_plane || display_bits > 0 || reference_frames > 0 || raw || average > 1 )
+		reader->readheader();
+	/*
+	the raw sidecars describe the channel and plane layout even if it's left
+	interleaved, and averaging keeps the channels and planes apart
+	*/
+	if ( by_channel || by_plane || raw || average > 1 ) {
+		std::vector<int> channels;
+		for ( auto & chan : reader->getSavedChans() )
+			channels.push_back(chan.second);
+		int planes = reader->getNumPlanes();
+		if ( by_channel || by_plane )
+			std::cout << "Deinterleaving " << channels.size() << " channel(s) and " << planes << " plane(s)" << std::endl;
+		if ( by_plane && planes < 2 )
+			std::cout << "WARNING: this file doesn't look like a fast-z stack so there is only one plane" << std::endl;
+		plan.deinterleave(channels, planes, by_channel, by_plane);
+	}
+	if ( raw && compression != COMPRESSION_NONE )
+		std::cout << "WARNING: raw output isn't compressed, ignoring -z" << std::endl;
+	plan.setRawOutput(raw);
+	// chunk sizes and part sizes count the averaged frames
+	plan.setTemporalBin(average);
+	plan.setSpatialBin(bin);
+	plan.setCrop(crop);
+	plan.setBitsPerSample(display_bits);
+	bool planned;
+	if ( to_stdout )
+		planned = plan.byFrames(dirs, std::max<int>(1, dirs.size()));
+	else if ( seconds > 0 || on_triggers )
+		planned = plan.byTime(dirs, seconds, on_triggers);
+	else if ( max_bytes > 0 )
+		planned = plan.byBytes(dirs, max_bytes);
+	else
+		planned = plan.byFrames(dirs, chunk_size);
+	if ( ! planned ) {
+		std::cout << "Nothing to split, so exiting\n";
+		exit(1);
 	}
+	if ( plan.isTimed() )
+		std::cout << "Splitting by acquisition time, the parts are worked out from the frame headers as they're read" << std::endl;
 	else
-		std::cout << "There are " << count << " frames in this tiff file" << std::endl;
-	std::string software_tag;
-	std::string image_tag;
-	cv::TiffWriter writer;
-	cv::Mat frame;
-	int tiff_part_num = 0;
-	for (int i = 0; i < count; ++i) {
-		if ( (i % chunk_size) == 0 ) {
-			std::string fname = outputfile_base + "_part" + std::to_string(tiff_part_num++) + ".tif";
-			std::cout << "Writing to " << fname << std::endl;
-			if ( writer.isOpened() )
-				writer.close();
-			writer.open(fname);
+		std::cout << "Splitting into " << plan.numParts() << " files, " << plan.totalBytes() << " bytes in total" << std::endl;
+	const unsigned int projection_workers = std::max(1u, std::min(4u, std::thread::hardware_concurrency() / 2));
+	if ( ! dry_run.empty() ) {
+		// the reader and the writer, then one for the transforms plus the projection workers
+		const bool transforms = reference_frames > 0 || average > 1 || bin > 1 || projections || display_bits > 0;
+		PlanReport report(reader.get(), &plan);
+		report.setThreads(2 + ( transforms ? 1 : 0 ) + ( projections ? projection_workers : 0 ));
+		if ( ! report.prepare(dirs) ) {
+			std::cout << "Could not work out the plan, so exiting\n";
+			exit(1);
+		}
+		if ( dry_run == "json" )
+			report.writeJSON(plan_out);
+		else
+			report.writeText(plan_out);
+		exit(0);
+	}
+	// the parts of a timed split aren't known up front so it can't be resumed
+	SplitJournal journal(outputfile_base + ".journal", command, inputfile);
+	const bool journaled = ! to_stdout && ! plan.isTimed();
+	if ( resume ) {
+		std::vector<int> done;
+		if ( journal.resume(plan, done) ) {
+			for ( int part : done )
+				plan.skipPart(part);
+			unsigned int next = 0;
+			while ( next < plan.numDirs() && plan.partFor(next) < 0 )
+				++next;
+			std::cout << "Resuming, " << done.size() << " of " << plan.numParts() << " files are already done";
+			if ( next < plan.numDirs() )
+				std::cout << ", carrying on from frame " << next;
+			std::cout << std::endl;
 		}
-		software_tag = reader->getSWTag(i);
-		image_tag = reader->getImDescTag(i);
-		frame = reader->readframe(i);
-		writer.writeSIHdr(software_tag, image_tag);
-		writer << frame;
+		else
+			std::cout << "There's nothing to resume in " << outputfile_base << ".journal, so starting from the beginning" << std::endl;
+	}
+	const bool journalOpen = journaled && journal.open();
+	if ( journaled && ! journalOpen )
+		std::cout << "WARNING: could not write " << outputfile_base << ".journal, so this split can't be resumed" << std::endl;
+	/*
+	The reader, any frame transforms and the writer each run on their own
+	thread - see split_pipeline.h
+	*/
+	SplitPipeline pipeline(reader.get(), &plan);
+	pipeline.setCompression(compression);
+	pipeline.setDirectIO(direct_io);
+	pipeline.setCrop(crop);
+	pipeline.setRawOutput(raw);
+	if ( to_stdout )
+		pipeline.setStreamOutput(STDOUT_FILENO);
+	if ( checksums )
+		pipeline.setManifest(outputfile_base + "_manifest.json");
+	if ( journalOpen )
+		pipeline.setJournal(&journal);
+	// registered at full resolution before anything is averaged together
+	if ( reference_frames > 0 )
+		pipeline.addTransform(new MotionCorrection(reader.get(), reference_frames, outputfile_base + "_shifts.csv"));
+	if ( average > 1 )
+		pipeline.addTransform(new TemporalBinning(reader.get(), &plan, average));
+	// after the averaging so only one frame per bin gets binned
+	if ( bin > 1 )
+		pipeline.addTransform(new SpatialBinning(reader.get(), bin));
+	// of the raw values, so before any conversion
+	if ( projections )
+		pipeline.addTransform(new Projections(projection_workers));
+	if ( display_bits > 0 )
+		pipeline.addTransform(new DisplayConversion(reader.get(), display_bits == 8 ? CV_8U : CV_16U));
+	if ( ! pipeline.run() ) {
+		if ( journalOpen )
+			std::cout << "Splitting failed, run the same command again with -j to carry on from where it got to\n";
+		else
+			std::cout << "Splitting failed, so exiting\n";
+		exit(1);
 	}
+	if ( journalOpen )
+		journal.remove();
+	std::cout << "Wrote " << pipeline.getFramesWritten() << " frames to " << pipeline.getPartsWritten() << " files" << std::endl;
 	exit(0);
 }
\ No newline at end of file
@@ -0,0 +1,78 @@
+#include "../include/manifest.h"
+#include "../include/json_string.h"
+
+#include <fstream>
+
+uint32_t SplitManifest::pixelDigest(const cv::Mat & frame)
+{
+	const std::size_t rowBytes = frame.cols * frame.elemSize();
+	if ( frame.isContinuous() )
+		return crc32c(0, frame.ptr(), rowBytes * frame.rows);
+	uint32_t crc = 0;
+	for (int row = 0; row < frame.rows; ++row)
+		crc = crc32c(crc, frame.ptr(row), rowBytes);
+	return crc;
+}
+
+uint32_t SplitManifest::tagDigest(const std::string & imDescTag, const std::string & swTag)
+{
+	return crc32c(crc32c(0, imDescTag.data(), imDescTag.size()), swTag.data(), swTag.size());
+}
+
+uint32_t SplitManifest::chain(uint32_t crc, uint32_t digest)
+{
+	const unsigned char bytes[4] = { (unsigned char)digest, (unsigned char)(digest >> 8),
+		(unsigned char)(digest >> 16), (unsigned char)(digest >> 24) };
+	return crc32c(crc, bytes, 4);
+}
+
+void SplitManifest::addFrame(const std::string & part, unsigned int dirnum, uint32_t pixels, uint32_t tags)
+{
+	auto found = m_index.find(part);
+	if ( found == m_index.end() )
+	{
+		found = m_index.emplace(part, m_parts.size()).first;
+		m_parts.emplace_back();
+		m_parts.back().filename = part;
+	}
+	Part & entry = m_parts[found->second];
+	entry.frames.push_back({dirnum, pixels, tags});
+	entry.pixels = chain(entry.pixels, pixels);
+	entry.tags = chain(entry.tags, tags);
+}
+
+bool SplitManifest::write(const std::string & filename) const
+{
+	std::ofstream json(filename);
+	if ( ! json )
+		return false;
+	json << "{\n";
+	json << "  \"algorithm\": \"crc32c\",\n";
+	json << "  \"source\": " << jsonString(m_source) << ",\n";
+	json << "  \"parts\": [";
+	for (std::size_t p = 0; p < m_parts.size(); ++p)
+	{
+		const Part & part = m_parts[p];
+		json << ( p ? ",\n" : "\n" );
+		json << "    {\n";
+		json << "      \"file\": " << jsonString(part.filename) << ",\n";
+		json << "      \"frames\": " << part.frames.size() << ",\n";
+		json << "      \"pixels\": \"" << crc32cHex(part.pixels) << "\",\n";
+		if ( m_withTags )
+			json << "      \"tags\": \"" << crc32cHex(part.tags) << "\",\n";
+		json << "      \"frame_digests\": [";
+		for (std::size_t f = 0; f < part.frames.size(); ++f)
+		{
+			const Frame & frame = part.frames[f];
+			json << ( f ? ",\n" : "\n" );
+			json << "        {\"dir\": " << frame.dirnum << ", \"pixels\": \"" << crc32cHex(frame.pixels) << "\"";
+			if ( m_withTags )
+				json << ", \"tags\": \"" << crc32cHex(frame.tags) << "\"";
+			json << "}";
+		}
+		json << "\n      ]\n";
+		json << "    }";
+	}
+	json << "\n  ]\n}\n";
+	return json.good();
+}
@@ -0,0 +1,115 @@
+#include "../include/plan_report.h"
+#include "../include/json_string.h"
+
+#include <algorithm>
+#include <iomanip>
+#include <iostream>
+
+// about what a single local disk manages; the estimate scales with it
+static const double assumedMBps = 500;
+
+bool PlanReport::prepare(const std::vector<DirInfo> & dirs)
+{
+	m_sourceFrames = dirs.size();
+	std::string swTag, imDescTag;
+	FrameTimes times;
+	auto timestamp = [&](unsigned int dirnum) {
+		if ( m_reader->readTags(dirnum, swTag, imDescTag) && m_reader->parseFrameTimes(imDescTag, times) )
+			return times.timestamp;
+		return -1.0;
+	};
+	std::vector<double> timed;
+	if ( m_plan->isTimed() )
+	{
+		// the same as the reader stage does, without the pixels
+		timed.resize(dirs.size());
+		for (unsigned int i = 0; i < dirs.size(); ++i)
+		{
+			if ( ! m_reader->readTags(i, swTag, imDescTag) )
+			{
+				std::cout << "Failed to read the tags of directory " << i << std::endl;
+				return false;
+			}
+			if ( ! m_reader->parseFrameTimes(imDescTag, times) )
+				times.timestamp = -1;
+			timed[i] = times.timestamp;
+			m_plan->timedPart(i, times);
+		}
+		m_plan->sizeTimedParts(dirs);
+	}
+	m_firstTimes.clear();
+	m_lastTimes.clear();
+	for (int p = 0; p < m_plan->numParts(); ++p)
+	{
+		const PartPlan & part = m_plan->getPart(p);
+		m_firstTimes.push_back(timed.empty() ? timestamp(part.firstDir) : timed[part.firstDir]);
+		m_lastTimes.push_back(timed.empty() ? timestamp(part.lastDir) : timed[part.lastDir]);
+	}
+	m_readBytes = 0;
+	for (unsigned int i = 0; i < dirs.size(); ++i)
+	{
+		if ( m_plan->partFor(i) >= 0 )
+			m_readBytes += dirs[i].stripBytes;
+	}
+	return true;
+}
+
+double PlanReport::estimatedSeconds() const
+{
+	return std::max(m_readBytes, m_plan->totalBytes()) / (assumedMBps * 1024 * 1024);
+}
+
+void PlanReport::writeText(std::ostream & out) const
+{
+	out << std::fixed << std::setprecision(3);
+	for (int p = 0; p < m_plan->numParts(); ++p)
+	{
+		const PartPlan & part = m_plan->getPart(p);
+		out << part.filename << ": " << part.nframes << " frames from directories " << part.firstDir << "-" << part.lastDir
+			<< ", " << part.bytes << " bytes as a " << ( part.bigtiff && ! m_plan->isRawOutput() ? "BigTIFF" :
+			m_plan->isRawOutput() ? "raw file" : "classic tiff" );
+		if ( m_firstTimes[p] >= 0 && m_lastTimes[p] >= 0 )
+			out << ", " << m_firstTimes[p] << "s to " << m_lastTimes[p] << "s";
+		out << "\n";
+	}
+	out << m_plan->numParts() << " files from " << m_sourceFrames << " frames, " << m_plan->totalBytes() << " bytes to write and "
+		<< m_readBytes << " to read using " << m_threads << " threads\n";
+	out << std::setprecision(1) << "About " << estimatedSeconds() << " seconds at " << std::setprecision(0) << assumedMBps << " MB/s\n";
+	out.flush();
+}
+
+void PlanReport::writeJSON(std::ostream & out) const
+{
+	auto time = [&](double t) {
+		if ( t < 0 )
+			out << "null";
+		else
+			out << std::setprecision(6) << t;
+	};
+	out << std::fixed;
+	out << "{\n";
+	out << "  \"source\": " << jsonString(m_reader->getfilename()) << ",\n";
+	out << "  \"source_frames\": " << m_sourceFrames << ",\n";
+	out << "  \"parts\": [";
+	for (int p = 0; p < m_plan->numParts(); ++p)
+	{
+		const PartPlan & part = m_plan->getPart(p);
+		out << ( p ? ",\n" : "\n" );
+		out << "    {\"file\": " << jsonString(part.filename) << ", \"stream\": " << part.stream << ", \"index\": " << part.index
+			<< ", \"first_dir\": " << part.firstDir << ", \"last_dir\": " << part.lastDir
+			<< ", \"frames\": " << part.nframes << ", \"bytes\": " << part.bytes
+			<< ", \"bigtiff\": " << ( part.bigtiff && ! m_plan->isRawOutput() ? "true" : "false" ) << ", \"first_timestamp\": ";
+		time(m_firstTimes[p]);
+		out << ", \"last_timestamp\": ";
+		time(m_lastTimes[p]);
+		out << "}";
+	}
+	out << "\n  ],\n";
+	out << "  \"read_bytes\": " << m_readBytes << ",\n";
+	out << "  \"write_bytes\": " << m_plan->totalBytes() << ",\n";
+	out << "  \"threads\": " << m_threads << ",\n";
+	out << "  \"assumed_mb_per_s\": " << std::setprecision(0) << assumedMBps << ",\n";
+	out << "  \"estimated_seconds\": " << std::setprecision(1) << estimatedSeconds() << "\n";
+	out << "}\n";
+	out.flush();
+}
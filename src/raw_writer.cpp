@@ -0,0 +1,214 @@
+#include "../include/raw_writer.h"
+#include "../include/json_string.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+
+RawWriter::~RawWriter()
+{
+	close();
+}
+
+const char * RawWriter::dtypeName(int depth)
+{
+	switch ( depth )
+	{
+		case CV_8U: return "uint8";
+		case CV_8S: return "int8";
+		case CV_16U: return "uint16";
+		case CV_16S: return "int16";
+		case CV_32S: return "int32";
+		case CV_32F: return "float32";
+		case CV_64F: return "float64";
+		default: return "unknown";
+	}
+}
+
+static_assert(sizeof(RawFrameHeader) == 48, "RawFrameHeader has to stay 48 bytes with no padding");
+
+bool RawWriter::streamFrame(TiffSink & sink, const cv::Mat & frame, RawFrameHeader header)
+{
+	const int depth = frame.depth();
+	header.rows = frame.rows;
+	header.cols = frame.cols;
+	header.bitsPerSample = frame.elemSize1() * 8;
+	header.sampleFormat = depth == CV_16S || depth == CV_8S || depth == CV_32S ? SAMPLEFORMAT_INT :
+		depth == CV_32F || depth == CV_64F ? SAMPLEFORMAT_IEEEFP : SAMPLEFORMAT_UINT;
+	header.samplesPerPixel = frame.channels();
+	const std::size_t rowBytes = frame.cols * frame.elemSize();
+	header.dataBytes = (uint64)rowBytes * frame.rows;
+	if ( sink.write(&header, sizeof(header)) != (tmsize_t)sizeof(header) )
+		return false;
+	for (int row = 0; row < frame.rows; ++row)
+	{
+		if ( sink.write(frame.ptr(row), rowBytes) != (tmsize_t)rowBytes )
+			return false;
+	}
+	sink.commit(sink.size());
+	return true;
+}
+
+bool RawWriter::open(const std::string & filename, const std::vector<int> & channels,
+	const std::vector<int> & planes, int first)
+{
+	close();
+	m_filename = filename;
+	m_channels = channels;
+	m_planes = planes;
+	m_first = first;
+	m_type = -1;
+	m_rows = m_cols = 0;
+	m_size = 0;
+	m_timestamps.clear();
+	if ( m_directio )
+	{
+		m_sink.reset(new DirectFileSink());
+		if ( m_sink->open(filename) )
+			m_fd = m_sink->fileno();
+	}
+	else
+		m_fd = ::open(filename.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	return m_fd >= 0;
+}
+
+bool RawWriter::reserve(uint64 bytes)
+{
+#ifdef __linux__
+	if ( m_fd >= 0 && bytes > 0 && fallocate(m_fd, FALLOC_FL_KEEP_SIZE, 0, (off_t)bytes) == 0 )
+	{
+		m_reserved = bytes;
+		return true;
+	}
+#endif
+	return false;
+}
+
+bool RawWriter::writeBytes(const uchar * data, std::size_t len)
+{
+	if ( m_sink )
+		return m_sink->write(data, len) == (tmsize_t)len;
+	while ( len > 0 )
+	{
+		ssize_t n = ::write(m_fd, data, len);
+		if ( n <= 0 )
+			return false;
+		data += n;
+		len -= n;
+	}
+	return true;
+}
+
+bool RawWriter::write(const cv::Mat & frame, double timestamp)
+{
+	if ( m_fd < 0 )
+		return false;
+	if ( m_type < 0 )
+	{
+		m_type = frame.type();
+		m_rows = frame.rows;
+		m_cols = frame.cols;
+	}
+	else if ( frame.type() != m_type || frame.rows != m_rows || frame.cols != m_cols )
+	{
+		std::cout << "Frames in " << m_filename << " have to be the same size and type" << std::endl;
+		return false;
+	}
+	const std::size_t rowBytes = frame.cols * frame.elemSize();
+	if ( frame.isContinuous() )
+	{
+		if ( ! writeBytes(frame.ptr(), rowBytes * frame.rows) )
+			return false;
+	}
+	else
+	{
+		for (int row = 0; row < frame.rows; ++row)
+		{
+			if ( ! writeBytes(frame.ptr(row), rowBytes) )
+				return false;
+		}
+	}
+	m_size += rowBytes * frame.rows;
+	m_timestamps.push_back(timestamp);
+	return true;
+}
+
+bool RawWriter::close()
+{
+	if ( m_fd < 0 )
+		return true;
+	bool ok = true;
+#ifdef __linux__
+	// hand back whatever of the reservation wasn't used; it's all past end-of-file, which
+	// only truncating frees (a DirectFileSink writes its last block and cuts back to m_size again)
+	if ( m_reserved > m_size && ftruncate(m_fd, (off_t)m_size) != 0 )
+		std::cout << "Failed to hand back the space reserved for " << m_filename << std::endl;
+#endif
+	m_reserved = 0;
+	if ( m_sink )
+	{
+		ok = m_sink->close() == 0;
+		m_sink.reset();
+	}
+	else
+		ok = ::close(m_fd) == 0;
+	m_fd = -1;
+	if ( ! writeSidecar() )
+	{
+		std::cout << "Failed to write the sidecar for " << m_filename << std::endl;
+		ok = false;
+	}
+	return ok;
+}
+
+bool RawWriter::writeSidecar()
+{
+	// base_part0.bin -> base_part0.json
+	std::string base = m_filename;
+	std::size_t dot = base.rfind('.');
+	std::size_t slash = base.rfind('/');
+	if ( dot != std::string::npos && ( slash == std::string::npos || dot > slash ) )
+		base = base.substr(0, dot);
+	std::ofstream json(base + ".json");
+	if ( ! json )
+		return false;
+	auto list = [&json](const std::vector<int> & values)
+	{
+		json << "[";
+		for (std::size_t i = 0; i < values.size(); ++i)
+			json << ( i ? ", " : "" ) << values[i];
+		json << "]";
+	};
+	const int samples = m_type < 0 ? 1 : CV_MAT_CN(m_type);
+	json << "{\n";
+	json << "  \"file\": " << jsonString(m_filename.substr(slash == std::string::npos ? 0 : slash + 1)) << ",\n";
+	json << "  \"dtype\": \"" << dtypeName(m_type < 0 ? CV_16S : CV_MAT_DEPTH(m_type)) << "\",\n";
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+	json << "  \"byteorder\": \"big\",\n";
+#else
+	json << "  \"byteorder\": \"little\",\n";
+#endif
+	json << "  \"shape\": [" << m_timestamps.size() << ", " << m_rows << ", " << m_cols;
+	if ( samples > 1 )
+		json << ", " << samples;
+	json << "],\n";
+	json << "  \"channels\": ";
+	list(m_channels);
+	json << ",\n  \"planes\": ";
+	list(m_planes);
+	json << ",\n  \"first\": " << m_first << ",\n";
+	json << "  \"timestamps\": [";
+	json << std::setprecision(15);
+	for (std::size_t i = 0; i < m_timestamps.size(); ++i)
+	{
+		json << ( i ? ", " : "" );
+		if ( m_timestamps[i] < 0 )
+			json << "null";
+		else
+			json << m_timestamps[i];
+	}
+	json << "]\n}\n";
+	return json.good();
+}
@@ -0,0 +1,655 @@
+#include "../include/simd_kernels.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+// the AVX2 kernels are built with a target attribute and only called if the CPU has it
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define HAVE_AVX2_DISPATCH
+#include <immintrin.h>
+#endif
+
+static bool avx2Allowed = true;
+
+bool usingAVX2()
+{
+#ifdef HAVE_AVX2_DISPATCH
+	static const bool avx2 = __builtin_cpu_supports("avx2");
+	return avx2 && avx2Allowed;
+#else
+	return false;
+#endif
+}
+
+void allowAVX2(bool allow)
+{
+	avx2Allowed = allow;
+}
+
+void accumulate16s(const int16_t * src, int32_t * sum, std::size_t n)
+{
+	std::size_t i = 0;
+#ifdef __SSE2__
+	for ( ; i + 8 <= n; i += 8)
+	{
+		__m128i x = _mm_loadu_si128((const __m128i*)(src + i));
+		// sign extend by putting each value in the top half of a 32-bit lane and shifting it down
+		__m128i lo = _mm_srai_epi32(_mm_unpacklo_epi16(x, x), 16);
+		__m128i hi = _mm_srai_epi32(_mm_unpackhi_epi16(x, x), 16);
+		__m128i * s = (__m128i*)(sum + i);
+		_mm_storeu_si128(s, _mm_add_epi32(_mm_loadu_si128(s), lo));
+		_mm_storeu_si128(s + 1, _mm_add_epi32(_mm_loadu_si128(s + 1), hi));
+	}
+#endif
+	for ( ; i < n; ++i)
+		sum[i] += src[i];
+}
+
+void average32s(const int32_t * sum, int16_t * dst, std::size_t n, int count)
+{
+	const float divisor = (float)count;
+	std::size_t i = 0;
+#ifdef __SSE2__
+	// cvtps_epi32 rounds with the current mode, as lrintf does, so the tail matches
+	const __m128 d = _mm_set1_ps(divisor);
+	for ( ; i + 8 <= n; i += 8)
+	{
+		__m128 lo = _mm_div_ps(_mm_cvtepi32_ps(_mm_loadu_si128((const __m128i*)(sum + i))), d);
+		__m128 hi = _mm_div_ps(_mm_cvtepi32_ps(_mm_loadu_si128((const __m128i*)(sum + i + 4))), d);
+		__m128i packed = _mm_packs_epi32(_mm_cvtps_epi32(lo), _mm_cvtps_epi32(hi));
+		_mm_storeu_si128((__m128i*)(dst + i), packed);
+	}
+#endif
+	for ( ; i < n; ++i)
+	{
+		long v = lrintf((float)sum[i] / divisor);
+		dst[i] = (int16_t)(v < INT16_MIN ? INT16_MIN : (v > INT16_MAX ? INT16_MAX : v));
+	}
+}
+
+void bin16s(const int16_t * src, std::size_t step, int factor, int16_t * dst, std::size_t width)
+{
+	const int shift = factor == 4 ? 4 : 2;
+	std::size_t i = 0;
+#ifdef __SSE2__
+	// madd against ones adds up neighbouring pairs of pixels into 32 bits
+	const __m128i ones = _mm_set1_epi16(1);
+	const __m128i half = _mm_set1_epi32(1 << (shift - 1));
+	if ( factor == 2 )
+	{
+		for ( ; i + 8 <= width; i += 8)
+		{
+			const int16_t * p = src + 2 * i;
+			__m128i lo = _mm_add_epi32(_mm_madd_epi16(_mm_loadu_si128((const __m128i*)p), ones),
+				_mm_madd_epi16(_mm_loadu_si128((const __m128i*)(p + step)), ones));
+			__m128i hi = _mm_add_epi32(_mm_madd_epi16(_mm_loadu_si128((const __m128i*)(p + 8)), ones),
+				_mm_madd_epi16(_mm_loadu_si128((const __m128i*)(p + 8 + step)), ones));
+			lo = _mm_srai_epi32(_mm_add_epi32(lo, half), shift);
+			hi = _mm_srai_epi32(_mm_add_epi32(hi, half), shift);
+			_mm_storeu_si128((__m128i*)(dst + i), _mm_packs_epi32(lo, hi));
+		}
+	}
+	else if ( factor == 4 )
+	{
+		// sums of pairs down all four rows for 8 pixels starting at p
+		auto pairs = [&](const int16_t * p)
+		{
+			__m128i sum = _mm_madd_epi16(_mm_loadu_si128((const __m128i*)p), ones);
+			for (int row = 1; row < 4; ++row)
+				sum = _mm_add_epi32(sum, _mm_madd_epi16(_mm_loadu_si128((const __m128i*)(p + row * step)), ones));
+			return sum;
+		};
+		// then add neighbouring pairs together (the evens to the odds)
+		auto quads = [](__m128i a, __m128i b)
+		{
+			__m128 fa = _mm_castsi128_ps(a), fb = _mm_castsi128_ps(b);
+			return _mm_add_epi32(_mm_castps_si128(_mm_shuffle_ps(fa, fb, _MM_SHUFFLE(2, 0, 2, 0))),
+				_mm_castps_si128(_mm_shuffle_ps(fa, fb, _MM_SHUFFLE(3, 1, 3, 1))));
+		};
+		for ( ; i + 8 <= width; i += 8)
+		{
+			const int16_t * p = src + 4 * i;
+			__m128i lo = quads(pairs(p), pairs(p + 8));
+			__m128i hi = quads(pairs(p + 16), pairs(p + 24));
+			lo = _mm_srai_epi32(_mm_add_epi32(lo, half), shift);
+			hi = _mm_srai_epi32(_mm_add_epi32(hi, half), shift);
+			_mm_storeu_si128((__m128i*)(dst + i), _mm_packs_epi32(lo, hi));
+		}
+	}
+#endif
+	for ( ; i < width; ++i)
+	{
+		int32_t sum = 0;
+		for (int row = 0; row < factor; ++row)
+			for (int col = 0; col < factor; ++col)
+				sum += src[row * step + factor * i + col];
+		dst[i] = (int16_t)((sum + (1 << (shift - 1))) >> shift);
+	}
+}
+
+void accumulateMoments16s(const int16_t * src, double * sum, double * sumsq, int16_t * max, std::size_t n)
+{
+	std::size_t i = 0;
+#ifdef __SSE2__
+	// two pixels to a register once they're doubles
+	auto moments = [&](__m128i v, std::size_t at)
+	{
+		__m128d lo = _mm_cvtepi32_pd(v);
+		__m128d hi = _mm_cvtepi32_pd(_mm_shuffle_epi32(v, _MM_SHUFFLE(1, 0, 3, 2)));
+		_mm_storeu_pd(sum + at, _mm_add_pd(_mm_loadu_pd(sum + at), lo));
+		_mm_storeu_pd(sum + at + 2, _mm_add_pd(_mm_loadu_pd(sum + at + 2), hi));
+		_mm_storeu_pd(sumsq + at, _mm_add_pd(_mm_loadu_pd(sumsq + at), _mm_mul_pd(lo, lo)));
+		_mm_storeu_pd(sumsq + at + 2, _mm_add_pd(_mm_loadu_pd(sumsq + at + 2), _mm_mul_pd(hi, hi)));
+	};
+	for ( ; i + 8 <= n; i += 8)
+	{
+		__m128i x = _mm_loadu_si128((const __m128i*)(src + i));
+		_mm_storeu_si128((__m128i*)(max + i), _mm_max_epi16(_mm_loadu_si128((const __m128i*)(max + i)), x));
+		moments(_mm_srai_epi32(_mm_unpacklo_epi16(x, x), 16), i);
+		moments(_mm_srai_epi32(_mm_unpackhi_epi16(x, x), 16), i + 4);
+	}
+#endif
+	for ( ; i < n; ++i)
+	{
+		const double v = src[i];
+		sum[i] += v;
+		sumsq[i] += v * v;
+		if ( src[i] > max[i] )
+			max[i] = src[i];
+	}
+}
+
+// the scalar version of the conversions, used for the tails of the vector loops
+template <typename T>
+static void convertTail(const int16_t * src, T * dst, std::size_t i, std::size_t n, int base, float scale, float top)
+{
+	for ( ; i < n; ++i)
+	{
+		float v = (float)(src[i] - base) * scale;
+		dst[i] = (T)lrintf(std::min(std::max(v, 0.0f), top));
+	}
+}
+
+#ifdef HAVE_AVX2_DISPATCH
+// 16 pixels of (src - base) * scale clamped to [0, top], as two sets of 8 int32
+__attribute__((target("avx2")))
+static inline void convertAVX2(const int16_t * src, __m256i & lo, __m256i & hi, __m256i base, __m256 scale, __m256 top)
+{
+	const __m256 zero = _mm256_setzero_ps();
+	__m256 a = _mm256_cvtepi32_ps(_mm256_sub_epi32(_mm256_cvtepi16_epi32(_mm_loadu_si128((const __m128i*)src)), base));
+	__m256 b = _mm256_cvtepi32_ps(_mm256_sub_epi32(_mm256_cvtepi16_epi32(_mm_loadu_si128((const __m128i*)(src + 8))), base));
+	lo = _mm256_cvtps_epi32(_mm256_min_ps(_mm256_max_ps(_mm256_mul_ps(a, scale), zero), top));
+	hi = _mm256_cvtps_epi32(_mm256_min_ps(_mm256_max_ps(_mm256_mul_ps(b, scale), zero), top));
+}
+
+__attribute__((target("avx2")))
+static std::size_t convert16sTo8uAVX2(const int16_t * src, uint8_t * dst, std::size_t n, int base, float scale)
+{
+	const __m256i b = _mm256_set1_epi32(base);
+	const __m256 s = _mm256_set1_ps(scale), top = _mm256_set1_ps(255.0f);
+	std::size_t i = 0;
+	for ( ; i + 16 <= n; i += 16)
+	{
+		__m256i lo, hi;
+		convertAVX2(src + i, lo, hi, b, s, top);
+		// packs works within each 128-bit lane so the quarters need putting back in order
+		__m256i words = _mm256_permute4x64_epi64(_mm256_packs_epi32(lo, hi), _MM_SHUFFLE(3, 1, 2, 0));
+		__m128i bytes = _mm_packus_epi16(_mm256_castsi256_si128(words), _mm256_extracti128_si256(words, 1));
+		_mm_storeu_si128((__m128i*)(dst + i), bytes);
+	}
+	return i;
+}
+
+__attribute__((target("avx2")))
+static std::size_t convert16sTo16uAVX2(const int16_t * src, uint16_t * dst, std::size_t n, int base, float scale)
+{
+	const __m256i b = _mm256_set1_epi32(base);
+	const __m256 s = _mm256_set1_ps(scale), top = _mm256_set1_ps(65535.0f);
+	std::size_t i = 0;
+	for ( ; i + 16 <= n; i += 16)
+	{
+		__m256i lo, hi;
+		convertAVX2(src + i, lo, hi, b, s, top);
+		__m256i words = _mm256_permute4x64_epi64(_mm256_packus_epi32(lo, hi), _MM_SHUFFLE(3, 1, 2, 0));
+		_mm256_storeu_si256((__m256i*)(dst + i), words);
+	}
+	return i;
+}
+#endif
+
+#ifdef __SSE2__
+// 8 pixels of (src - base) * scale clamped to [0, top], as two sets of 4 int32
+static inline void convertSSE2(const int16_t * src, __m128i & lo, __m128i & hi, __m128i base, __m128 scale, __m128 top)
+{
+	const __m128 zero = _mm_setzero_ps();
+	__m128i x = _mm_loadu_si128((const __m128i*)src);
+	__m128 a = _mm_cvtepi32_ps(_mm_sub_epi32(_mm_srai_epi32(_mm_unpacklo_epi16(x, x), 16), base));
+	__m128 b = _mm_cvtepi32_ps(_mm_sub_epi32(_mm_srai_epi32(_mm_unpackhi_epi16(x, x), 16), base));
+	lo = _mm_cvtps_epi32(_mm_min_ps(_mm_max_ps(_mm_mul_ps(a, scale), zero), top));
+	hi = _mm_cvtps_epi32(_mm_min_ps(_mm_max_ps(_mm_mul_ps(b, scale), zero), top));
+}
+#endif
+
+void convert16sTo8u(const int16_t * src, uint8_t * dst, std::size_t n, int base, float scale)
+{
+	std::size_t i = 0;
+#ifdef HAVE_AVX2_DISPATCH
+	if ( usingAVX2() )
+		i = convert16sTo8uAVX2(src, dst, n, base, scale);
+#endif
+#ifdef __SSE2__
+	const __m128i b = _mm_set1_epi32(base);
+	const __m128 s = _mm_set1_ps(scale), top = _mm_set1_ps(255.0f);
+	for ( ; i + 8 <= n; i += 8)
+	{
+		__m128i lo, hi;
+		convertSSE2(src + i, lo, hi, b, s, top);
+		__m128i words = _mm_packs_epi32(lo, hi);
+		_mm_storel_epi64((__m128i*)(dst + i), _mm_packus_epi16(words, words));
+	}
+#endif
+	convertTail(src, dst, i, n, base, scale, 255.0f);
+}
+
+void convert16sTo16u(const int16_t * src, uint16_t * dst, std::size_t n, int base, float scale)
+{
+	std::size_t i = 0;
+#ifdef HAVE_AVX2_DISPATCH
+	if ( usingAVX2() )
+		i = convert16sTo16uAVX2(src, dst, n, base, scale);
+#endif
+#ifdef __SSE2__
+	const __m128i b = _mm_set1_epi32(base);
+	const __m128 s = _mm_set1_ps(scale), top = _mm_set1_ps(65535.0f);
+	// SSE2 has no unsigned 32 -> 16 bit pack so shift into signed range and back
+	const __m128i bias = _mm_set1_epi32(32768);
+	const __m128i flip = _mm_set1_epi16((short)0x8000);
+	for ( ; i + 8 <= n; i += 8)
+	{
+		__m128i lo, hi;
+		convertSSE2(src + i, lo, hi, b, s, top);
+		__m128i words = _mm_packs_epi32(_mm_sub_epi32(lo, bias), _mm_sub_epi32(hi, bias));
+		_mm_storeu_si128((__m128i*)(dst + i), _mm_xor_si128(words, flip));
+	}
+#endif
+	convertTail(src, dst, i, n, base, scale, 65535.0f);
+}
+
+/*
+The colour and palette rows for utils.cpp. Gray is the same 14-bit fixed
+point sum as there, with weights that add up to exactly 1 << 14
+*/
+static const int grayShift = 14;
+static const int grayR = (int)(0.299 * (1 << grayShift) + 0.5);
+static const int grayG = (int)(0.587 * (1 << grayShift) + 0.5);
+static const int grayB = (1 << grayShift) - grayR - grayG;
+
+template <typename T>
+static void grayTail(const T * src, int cn, T * dst, std::size_t i, std::size_t n, bool swapRB)
+{
+	const int b = swapRB ? 2 : 0;
+	for ( ; i < n; ++i)
+	{
+		const T * p = src + i * cn;
+		dst[i] = (T)((p[b] * grayB + p[1] * grayG + p[b ^ 2] * grayR + (1 << (grayShift - 1))) >> grayShift);
+	}
+}
+
+#ifdef HAVE_AVX2_DISPATCH
+/*
+Gray sums of 8 pixels given as two sets of 4 with 16 bits for each of B,
+G, R and a fourth channel that has no weight. madd does B and G and R and
+the fourth channel of each pixel, then hadd puts those together (within
+each 128-bit lane, so the pixels come out as 0 1 4 5 2 3 6 7 until the
+permute)
+*/
+__attribute__((target("avx2")))
+static inline __m256i graySumsAVX2(__m256i p0123, __m256i p4567, __m256i weights)
+{
+	__m256i sums = _mm256_hadd_epi32(_mm256_madd_epi16(p0123, weights), _mm256_madd_epi16(p4567, weights));
+	return _mm256_permutevar8x32_epi32(sums, _mm256_setr_epi32(0, 1, 4, 5, 2, 3, 6, 7));
+}
+
+// 4 pixels from p with the channels spread out to 16 bits each, 4 to a pixel
+template <int cn>
+__attribute__((target("avx2")))
+static inline __m256i grayQuadAVX2(const uint8_t * p)
+{
+	__m128i x = _mm_loadu_si128((const __m128i*)p);
+	if ( cn == 3 )
+		x = _mm_shuffle_epi8(x, _mm_setr_epi8(0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11, -1));
+	return _mm256_cvtepu8_epi16(x);
+}
+
+template <int cn>
+__attribute__((target("avx2")))
+static inline __m256i grayQuadAVX2(const uint16_t * p)
+{
+	if ( cn == 4 )
+		return _mm256_loadu_si256((const __m256i*)p);
+	const __m128i spread = _mm_setr_epi8(0, 1, 2, 3, 4, 5, -1, -1, 6, 7, 8, 9, 10, 11, -1, -1);
+	__m128i lo = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)p), spread);
+	__m128i hi = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(p + 6)), spread);
+	return _mm256_inserti128_si256(_mm256_castsi128_si256(lo), hi, 1);
+}
+
+template <int cn>
+__attribute__((target("avx2")))
+static std::size_t bgrToGray8uAVX2(const uint8_t * src, uint8_t * dst, std::size_t n, short w0, short w2)
+{
+	const __m256i weights = _mm256_setr_epi16(w0, grayG, w2, 0, w0, grayG, w2, 0, w0, grayG, w2, 0, w0, grayG, w2, 0);
+	const __m256i half = _mm256_set1_epi32(1 << (grayShift - 1));
+	std::size_t i = 0;
+	// the 3-channel loads read 4 bytes past the last pixel they use
+	for ( ; i + 32 + ( cn == 3 ? 2 : 0 ) <= n; i += 32)
+	{
+		const uint8_t * p = src + i * cn;
+		__m256i gray[4];
+		for (int k = 0; k < 4; ++k)
+		{
+			__m256i sums = graySumsAVX2(grayQuadAVX2<cn>(p + 8 * k * cn), grayQuadAVX2<cn>(p + (8 * k + 4) * cn), weights);
+			gray[k] = _mm256_srai_epi32(_mm256_add_epi32(sums, half), grayShift);
+		}
+		__m256i lo = _mm256_permute4x64_epi64(_mm256_packs_epi32(gray[0], gray[1]), _MM_SHUFFLE(3, 1, 2, 0));
+		__m256i hi = _mm256_permute4x64_epi64(_mm256_packs_epi32(gray[2], gray[3]), _MM_SHUFFLE(3, 1, 2, 0));
+		__m256i bytes = _mm256_permute4x64_epi64(_mm256_packus_epi16(lo, hi), _MM_SHUFFLE(3, 1, 2, 0));
+		_mm256_storeu_si256((__m256i*)(dst + i), bytes);
+	}
+	return i;
+}
+
+template <int cn>
+__attribute__((target("avx2")))
+static std::size_t bgrToGray16uAVX2(const uint16_t * src, uint16_t * dst, std::size_t n, short w0, short w2)
+{
+	const __m256i weights = _mm256_setr_epi16(w0, grayG, w2, 0, w0, grayG, w2, 0, w0, grayG, w2, 0, w0, grayG, w2, 0);
+	// see bgrToGray16u for the flip and offset
+	const __m256i flip = _mm256_set1_epi16((short)0x8000);
+	const __m256i offset = _mm256_set1_epi32((32768 << grayShift) + (1 << (grayShift - 1)));
+	std::size_t i = 0;
+	for ( ; i + 16 + ( cn == 3 ? 2 : 0 ) <= n; i += 16)
+	{
+		const uint16_t * p = src + i * cn;
+		__m256i gray[2];
+		for (int k = 0; k < 2; ++k)
+		{
+			__m256i sums = graySumsAVX2(_mm256_xor_si256(grayQuadAVX2<cn>(p + 8 * k * cn), flip),
+				_mm256_xor_si256(grayQuadAVX2<cn>(p + (8 * k + 4) * cn), flip), weights);
+			gray[k] = _mm256_srai_epi32(_mm256_add_epi32(sums, offset), grayShift);
+		}
+		__m256i words = _mm256_permute4x64_epi64(_mm256_packus_epi32(gray[0], gray[1]), _MM_SHUFFLE(3, 1, 2, 0));
+		_mm256_storeu_si256((__m256i*)(dst + i), words);
+	}
+	return i;
+}
+
+// both nibbles of 32 index bytes at once, interleaved back into pixel order
+__attribute__((target("avx2")))
+static std::size_t paletteRow4AVX2(const uint8_t * indices, const uint8_t * palette, uint8_t * dst, std::size_t n)
+{
+	const __m256i table = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i*)palette));
+	const __m256i nibble = _mm256_set1_epi8(15);
+	std::size_t i = 0;
+	for ( ; i + 64 <= n; i += 64)
+	{
+		__m256i x = _mm256_loadu_si256((const __m256i*)(indices + i / 2));
+		__m256i first = _mm256_shuffle_epi8(table, _mm256_and_si256(_mm256_srli_epi16(x, 4), nibble));
+		__m256i second = _mm256_shuffle_epi8(table, _mm256_and_si256(x, nibble));
+		__m256i a = _mm256_unpacklo_epi8(first, second);
+		__m256i b = _mm256_unpackhi_epi8(first, second);
+		_mm256_storeu_si256((__m256i*)(dst + i), _mm256_permute2x128_si256(a, b, 0x20));
+		_mm256_storeu_si256((__m256i*)(dst + i + 32), _mm256_permute2x128_si256(a, b, 0x31));
+	}
+	return i;
+}
+#endif
+
+#ifdef __SSE2__
+/*
+Gray sums of 4 pixels with 16 bits for each of B, G, R and a fourth
+channel that has no weight, two pixels to a register: madd does B and G
+and R and the fourth channel, then the evens get added to the odds
+*/
+static inline __m128i graySumsSSE2(__m128i p01, __m128i p23, __m128i weights)
+{
+	__m128 a = _mm_castsi128_ps(_mm_madd_epi16(p01, weights));
+	__m128 b = _mm_castsi128_ps(_mm_madd_epi16(p23, weights));
+	return _mm_add_epi32(_mm_castps_si128(_mm_shuffle_ps(a, b, _MM_SHUFFLE(2, 0, 2, 0))),
+		_mm_castps_si128(_mm_shuffle_ps(a, b, _MM_SHUFFLE(3, 1, 3, 1))));
+}
+
+/*
+Spreads 4 packed 3-channel pixels (lo = b0 g0 r0 b1 g1 r1 b2 g2, hi =
+r2 b3 g3 r3 ...) out to 4 lanes each without a byte shuffle. The lanes in
+between get whatever was there, which the zero weight takes care of
+*/
+static inline void spreadBGR(__m128i lo, __m128i hi, __m128i & p01, __m128i & p23)
+{
+	p01 = _mm_castpd_si128(_mm_move_sd(_mm_castsi128_pd(_mm_slli_si128(lo, 2)), _mm_castsi128_pd(lo)));
+	p23 = _mm_or_si128(_mm_or_si128(_mm_srli_si128(lo, 12), _mm_move_epi64(_mm_slli_si128(hi, 4))), _mm_slli_si128(hi, 6));
+}
+
+template <int cn>
+static std::size_t bgrToGray8uSSE2(const uint8_t * src, uint8_t * dst, std::size_t n, __m128i weights)
+{
+	const __m128i half = _mm_set1_epi32(1 << (grayShift - 1));
+	const __m128i zero = _mm_setzero_si128();
+	auto gray4 = [&](const uint8_t * p)
+	{
+		__m128i x = _mm_loadu_si128((const __m128i*)p), p01, p23;
+		if ( cn == 4 )
+		{
+			p01 = _mm_unpacklo_epi8(x, zero);
+			p23 = _mm_unpackhi_epi8(x, zero);
+		}
+		else
+			spreadBGR(_mm_unpacklo_epi8(x, zero), _mm_unpackhi_epi8(x, zero), p01, p23);
+		return _mm_srai_epi32(_mm_add_epi32(graySumsSSE2(p01, p23, weights), half), grayShift);
+	};
+	std::size_t i = 0;
+	// the 3-channel loads read 4 bytes past the last pixel they use
+	for ( ; i + 16 + ( cn == 3 ? 2 : 0 ) <= n; i += 16)
+	{
+		const uint8_t * p = src + i * cn;
+		__m128i lo = _mm_packs_epi32(gray4(p), gray4(p + 4 * cn));
+		__m128i hi = _mm_packs_epi32(gray4(p + 8 * cn), gray4(p + 12 * cn));
+		_mm_storeu_si128((__m128i*)(dst + i), _mm_packus_epi16(lo, hi));
+	}
+	return i;
+}
+
+template <int cn>
+static std::size_t bgrToGray16uSSE2(const uint16_t * src, uint16_t * dst, std::size_t n, __m128i weights)
+{
+	const __m128i flip = _mm_set1_epi16((short)0x8000);
+	const __m128i offset = _mm_set1_epi32((32768 << grayShift) + (1 << (grayShift - 1)));
+	const __m128i bias = _mm_set1_epi32(32768);
+	auto gray4 = [&](const uint16_t * p)
+	{
+		__m128i p01, p23;
+		if ( cn == 4 )
+		{
+			p01 = _mm_loadu_si128((const __m128i*)p);
+			p23 = _mm_loadu_si128((const __m128i*)(p + 8));
+		}
+		else
+			spreadBGR(_mm_loadu_si128((const __m128i*)p), _mm_loadu_si128((const __m128i*)(p + 8)), p01, p23);
+		__m128i sums = graySumsSSE2(_mm_xor_si128(p01, flip), _mm_xor_si128(p23, flip), weights);
+		return _mm_srai_epi32(_mm_add_epi32(sums, offset), grayShift);
+	};
+	std::size_t i = 0;
+	for ( ; i + 8 + ( cn == 3 ? 2 : 0 ) <= n; i += 8)
+	{
+		const uint16_t * p = src + i * cn;
+		// no unsigned 32 -> 16 bit pack, as in convert16sTo16u
+		__m128i words = _mm_packs_epi32(_mm_sub_epi32(gray4(p), bias), _mm_sub_epi32(gray4(p + 4 * cn), bias));
+		_mm_storeu_si128((__m128i*)(dst + i), _mm_xor_si128(words, flip));
+	}
+	return i;
+}
+#endif
+
+void bgrToGray8u(const uint8_t * src, int cn, uint8_t * dst, std::size_t n, bool swapRB)
+{
+	std::size_t i = 0;
+	const short w0 = swapRB ? grayR : grayB, w2 = swapRB ? grayB : grayR;
+#ifdef HAVE_AVX2_DISPATCH
+	if ( usingAVX2() && cn == 3 )
+		i = bgrToGray8uAVX2<3>(src, dst, n, w0, w2);
+	else if ( usingAVX2() && cn == 4 )
+		i = bgrToGray8uAVX2<4>(src, dst, n, w0, w2);
+#endif
+#ifdef __SSE2__
+	const __m128i weights = _mm_setr_epi16(w0, grayG, w2, 0, w0, grayG, w2, 0);
+	if ( cn == 3 )
+		i += bgrToGray8uSSE2<3>(src + i * 3, dst + i, n - i, weights);
+	else if ( cn == 4 )
+		i += bgrToGray8uSSE2<4>(src + i * 4, dst + i, n - i, weights);
+#endif
+	grayTail(src, cn, dst, i, n, swapRB);
+}
+
+void bgrToGray16u(const uint16_t * src, int cn, uint16_t * dst, std::size_t n, bool swapRB)
+{
+	std::size_t i = 0;
+	const short w0 = swapRB ? grayR : grayB, w2 = swapRB ? grayB : grayR;
+	/*
+	madd multiplies signed 16-bit numbers, so the pixels get 32768 taken
+	off (by flipping the top bit). That takes 32768 << 14 off every sum,
+	which is put back along with the rounding
+	*/
+#ifdef HAVE_AVX2_DISPATCH
+	if ( usingAVX2() && cn == 3 )
+		i = bgrToGray16uAVX2<3>(src, dst, n, w0, w2);
+	else if ( usingAVX2() && cn == 4 )
+		i = bgrToGray16uAVX2<4>(src, dst, n, w0, w2);
+#endif
+#ifdef __SSE2__
+	const __m128i weights = _mm_setr_epi16(w0, grayG, w2, 0, w0, grayG, w2, 0);
+	if ( cn == 3 )
+		i += bgrToGray16uSSE2<3>(src + i * 3, dst + i, n - i, weights);
+	else if ( cn == 4 )
+		i += bgrToGray16uSSE2<4>(src + i * 4, dst + i, n - i, weights);
+#endif
+	grayTail(src, cn, dst, i, n, swapRB);
+}
+
+void grayToBGR16u(const uint16_t * src, uint16_t * dst, std::size_t n)
+{
+	std::size_t i = 0;
+#ifdef __SSE2__
+	// 8 grays make 3 registers of output, each put together from two 4-lane shuffles
+	for ( ; i + 8 <= n; i += 8)
+	{
+		__m128i g = _mm_loadu_si128((const __m128i*)(src + i));
+		__m128i * out = (__m128i*)(dst + 3 * i);
+		_mm_storeu_si128(out, _mm_unpacklo_epi64(_mm_shufflelo_epi16(g, _MM_SHUFFLE(1, 0, 0, 0)),
+			_mm_shufflelo_epi16(g, _MM_SHUFFLE(2, 2, 1, 1))));
+		_mm_storeu_si128(out + 1, _mm_castpd_si128(_mm_move_sd(_mm_castsi128_pd(_mm_shufflehi_epi16(g, _MM_SHUFFLE(1, 0, 0, 0))),
+			_mm_castsi128_pd(_mm_shufflelo_epi16(g, _MM_SHUFFLE(3, 3, 3, 2))))));
+		_mm_storeu_si128(out + 2, _mm_unpackhi_epi64(_mm_shufflehi_epi16(g, _MM_SHUFFLE(2, 2, 1, 1)),
+			_mm_shufflehi_epi16(g, _MM_SHUFFLE(3, 3, 3, 2))));
+	}
+#endif
+	for ( ; i < n; ++i)
+		dst[3 * i] = dst[3 * i + 1] = dst[3 * i + 2] = src[i];
+}
+
+void bgraToBGR16u(const uint16_t * src, uint16_t * dst, std::size_t n, bool swapRB)
+{
+	std::size_t i = 0;
+#ifdef __SSE2__
+	const __m128i keep0 = _mm_setr_epi16(-1, 0, 0, 0, 0, 0, 0, 0);
+	const __m128i keep01 = _mm_setr_epi16(-1, -1, 0, 0, 0, 0, 0, 0);
+	const __m128i keep012 = _mm_setr_epi16(-1, -1, -1, 0, 0, 0, 0, 0);
+	const __m128i keep123 = _mm_setr_epi16(0, -1, -1, -1, 0, 0, 0, 0);
+	const __m128i keep234 = _mm_setr_epi16(0, 0, -1, -1, -1, 0, 0, 0);
+	const __m128i keep345 = _mm_setr_epi16(0, 0, 0, -1, -1, -1, 0, 0);
+	const __m128i keep456 = _mm_setr_epi16(0, 0, 0, 0, -1, -1, -1, 0);
+	const __m128i keep567 = _mm_setr_epi16(0, 0, 0, 0, 0, -1, -1, -1);
+	const __m128i keep7 = _mm_setr_epi16(0, 0, 0, 0, 0, 0, 0, -1);
+	auto load = [&](const uint16_t * p)
+	{
+		__m128i x = _mm_loadu_si128((const __m128i*)p);
+		if ( swapRB )
+			x = _mm_shufflehi_epi16(_mm_shufflelo_epi16(x, _MM_SHUFFLE(3, 0, 1, 2)), _MM_SHUFFLE(3, 0, 1, 2));
+		return x;
+	};
+	// 8 pixels, two to a register, shifted into place without their alphas
+	for ( ; i + 8 <= n; i += 8)
+	{
+		const uint16_t * p = src + 4 * i;
+		__m128i v0 = load(p), v1 = load(p + 8), v2 = load(p + 16), v3 = load(p + 24);
+		__m128i * out = (__m128i*)(dst + 3 * i);
+		_mm_storeu_si128(out, _mm_or_si128(_mm_or_si128(_mm_and_si128(v0, keep012),
+			_mm_and_si128(_mm_srli_si128(v0, 2), keep345)), _mm_slli_si128(v1, 12)));
+		_mm_storeu_si128(out + 1, _mm_or_si128(_mm_or_si128(_mm_and_si128(_mm_srli_si128(v1, 4), keep0),
+			_mm_and_si128(_mm_srli_si128(v1, 6), keep123)), _mm_or_si128(_mm_and_si128(_mm_slli_si128(v2, 8), keep456),
+			_mm_and_si128(_mm_slli_si128(v2, 6), keep7))));
+		_mm_storeu_si128(out + 2, _mm_or_si128(_mm_or_si128(_mm_and_si128(_mm_srli_si128(v2, 10), keep01),
+			_mm_and_si128(_mm_slli_si128(v3, 4), keep234)), _mm_and_si128(_mm_slli_si128(v3, 2), keep567)));
+	}
+#endif
+	const int b = swapRB ? 2 : 0;
+	for ( ; i < n; ++i)
+	{
+		dst[3 * i] = src[4 * i + b];
+		dst[3 * i + 1] = src[4 * i + 1];
+		dst[3 * i + 2] = src[4 * i + (b ^ 2)];
+	}
+}
+
+void paletteRow8(const uint8_t * indices, const uint8_t * palette, uint8_t * dst, std::size_t n)
+{
+	// a 256 entry table is too big to shuffle from, and looking it up in 16 pieces isn't any quicker than this
+	for (std::size_t i = 0; i < n; ++i)
+		dst[i] = palette[indices[i]];
+}
+
+void paletteRow4(const uint8_t * indices, const uint8_t * palette, uint8_t * dst, std::size_t n)
+{
+	std::size_t i = 0;
+#ifdef HAVE_AVX2_DISPATCH
+	if ( usingAVX2() )
+		i = paletteRow4AVX2(indices, palette, dst, n);
+#endif
+	for ( ; i + 2 <= n; i += 2)
+	{
+		const int idx = indices[i / 2];
+		dst[i] = palette[idx >> 4];
+		dst[i + 1] = palette[idx & 15];
+	}
+	if ( i < n )
+		dst[i] = palette[indices[i / 2] >> 4];
+}
+
+void paletteRow1(const uint8_t * indices, const uint8_t * palette, uint8_t * dst, std::size_t n)
+{
+	std::size_t i = 0;
+#ifdef __SSE2__
+	// each index byte copied to 8 lanes, each lane testing its own bit
+	const __m128i bits = _mm_setr_epi8(-128, 64, 32, 16, 8, 4, 2, 1, -128, 64, 32, 16, 8, 4, 2, 1);
+	const __m128i zero = _mm_set1_epi8((char)palette[0]), one = _mm_set1_epi8((char)palette[1]);
+	auto expand = [&](__m128i x, uint8_t * out)
+	{
+		__m128i set = _mm_cmpeq_epi8(_mm_and_si128(x, bits), bits);
+		_mm_storeu_si128((__m128i*)out, _mm_or_si128(_mm_and_si128(set, one), _mm_andnot_si128(set, zero)));
+	};
+	for ( ; i + 32 <= n; i += 32)
+	{
+		int32_t four;
+		std::memcpy(&four, indices + i / 8, 4);
+		__m128i x = _mm_cvtsi32_si128(four);
+		x = _mm_unpacklo_epi8(x, x);
+		x = _mm_unpacklo_epi16(x, x);
+		expand(_mm_unpacklo_epi32(x, x), dst + i);
+		expand(_mm_unpackhi_epi32(x, x), dst + i + 16);
+	}
+#endif
+	for ( ; i < n; ++i)
+		dst[i] = palette[( indices[i / 8] >> ( 7 - ( i & 7 ) ) ) & 1];
+}
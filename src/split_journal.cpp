@@ -0,0 +1,177 @@
+#include "../include/split_journal.h"
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+
+#include "../include/crc32c.h"
+
+static const char * journalHeader = "TiffSplitter journal 1";
+// how much of each end of a part goes into its checksum
+static const uint64 headBytes = 4 << 10;
+static const uint64 tailBytes = 64 << 10;
+
+SplitJournal::~SplitJournal()
+{
+	if ( m_fd >= 0 )
+		::close(m_fd);
+}
+
+bool SplitJournal::sourceLine(std::string & line) const
+{
+	struct stat st;
+	if ( stat(m_source.c_str(), &st) != 0 )
+		return false;
+	line = "source " + std::to_string((uint64)st.st_size) + " " + std::to_string((long long)st.st_mtime);
+	return true;
+}
+
+bool SplitJournal::fileDigest(const std::string & filename, bool sync, uint64 & size, uint32_t & crc)
+{
+	int fd = ::open(filename.c_str(), O_RDONLY);
+	if ( fd < 0 )
+		return false;
+	struct stat st;
+	bool ok = fstat(fd, &st) == 0 && ( ! sync || fdatasync(fd) == 0 );
+	if ( ok )
+	{
+		size = st.st_size;
+		// the two ends, not overlapping if the file is small
+		const uint64 head = std::min(size, headBytes);
+		const uint64 tail = std::min(size - head, tailBytes);
+		std::vector<char> buf(head + tail);
+		ok = pread(fd, buf.data(), head, 0) == (ssize_t)head &&
+			pread(fd, buf.data() + head, tail, size - tail) == (ssize_t)tail;
+		crc = crc32c(0, buf.data(), buf.size());
+	}
+	::close(fd);
+	return ok;
+}
+
+bool SplitJournal::resume(const SplitPlan & plan, std::vector<int> & done)
+{
+	done.clear();
+	m_done.clear();
+	std::ifstream journal(m_filename);
+	if ( ! journal )
+		return false;
+	std::string line, source;
+	if ( ! std::getline(journal, line) || line != journalHeader )
+	{
+		std::cout << m_filename << " isn't a journal" << std::endl;
+		return false;
+	}
+	if ( ! std::getline(journal, line) || line != "command " + m_command )
+	{
+		std::cout << m_filename << " is from a different command" << std::endl;
+		return false;
+	}
+	if ( ! std::getline(journal, line) || ! sourceLine(source) || line != source )
+	{
+		std::cout << "The source has changed since " << m_filename << " was written" << std::endl;
+		return false;
+	}
+	// a last line without its newline was cut short by a crash so it doesn't count
+	while ( std::getline(journal, line) && ! journal.eof() )
+	{
+		std::istringstream fields(line);
+		std::string tag, filename, hex;
+		int part;
+		unsigned int firstDir, lastDir, nframes;
+		uint64 size;
+		if ( ! ( fields >> tag >> part >> firstDir >> lastDir >> nframes >> size >> hex ) || tag != "done" ||
+			! std::getline(fields >> std::ws, filename) )
+			continue;
+		if ( part < 0 || part >= plan.numParts() )
+			continue;
+		const PartPlan & info = plan.getPart(part);
+		if ( info.filename != filename || info.firstDir != firstDir || info.lastDir != lastDir || info.nframes != nframes )
+		{
+			std::cout << filename << " isn't planned the same way any more, so it will be written again" << std::endl;
+			continue;
+		}
+		uint64 actualSize;
+		uint32_t crc;
+		if ( ! fileDigest(filename, false, actualSize, crc) || actualSize != size || crc32cHex(crc) != hex )
+		{
+			std::cout << filename << " has changed since it was written, so it will be written again" << std::endl;
+			continue;
+		}
+		done.push_back(part);
+		m_done.push_back(line);
+	}
+	return true;
+}
+
+bool SplitJournal::open()
+{
+	std::string source;
+	if ( ! sourceLine(source) )
+		return false;
+	/*
+	Written in full to the side and renamed over the old journal, so a
+	crash now still leaves one or the other
+	*/
+	const std::string temp = m_filename + ".tmp";
+	int fd = ::open(temp.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if ( fd < 0 )
+		return false;
+	std::string contents = std::string(journalHeader) + "\ncommand " + m_command + "\n" + source + "\n";
+	for ( auto & line : m_done )
+		contents += line + "\n";
+	bool ok = write(fd, contents.data(), contents.size()) == (ssize_t)contents.size() && fdatasync(fd) == 0;
+	::close(fd);
+	if ( ! ok || rename(temp.c_str(), m_filename.c_str()) != 0 )
+	{
+		unlink(temp.c_str());
+		return false;
+	}
+	m_fd = ::open(m_filename.c_str(), O_WRONLY | O_APPEND);
+	return m_fd >= 0;
+}
+
+bool SplitJournal::append(const std::string & line)
+{
+	if ( m_fd < 0 )
+		return false;
+	const std::string text = line + "\n";
+	return write(m_fd, text.data(), text.size()) == (ssize_t)text.size() && fdatasync(m_fd) == 0;
+}
+
+bool SplitJournal::partDone(int part, const PartPlan & info)
+{
+	uint64 size;
+	uint32_t crc;
+	if ( ! fileDigest(info.filename, true, size, crc) )
+		return false;
+	// the new file's directory entry has to be on disk too
+	std::string dir = ".";
+	std::size_t slash = info.filename.rfind('/');
+	if ( slash != std::string::npos )
+		dir = slash == 0 ? "/" : info.filename.substr(0, slash);
+	int dirfd = ::open(dir.c_str(), O_RDONLY | O_DIRECTORY);
+	if ( dirfd >= 0 )
+	{
+		fsync(dirfd);
+		::close(dirfd);
+	}
+	std::ostringstream line;
+	line << "done " << part << " " << info.firstDir << " " << info.lastDir << " " << info.nframes << " "
+		<< size << " " << crc32cHex(crc) << " " << info.filename;
+	return append(line.str());
+}
+
+void SplitJournal::remove()
+{
+	if ( m_fd >= 0 )
+	{
+		::close(m_fd);
+		m_fd = -1;
+	}
+	unlink(m_filename.c_str());
+}
@@ -0,0 +1,332 @@
+#include "../include/split_pipeline.h"
+
+#include <thread>
+
+SplitPipeline::SplitPipeline(SITiffReader * reader, SplitPlan * plan, unsigned int depth) :
+	m_reader(reader), m_plan(plan), m_depth(depth)
+{
+	if ( m_depth < 2 )
+		m_depth = 2;
+}
+
+SplitPipeline::~SplitPipeline() {}
+
+void SplitPipeline::addTransform(FrameTransform * transform)
+{
+	m_transforms.emplace_back(transform);
+}
+
+bool SplitPipeline::run()
+{
+	/*
+	Enough packets to fill both forward queues, plus one being worked on
+	by each stage, plus anything the transforms might be holding on to
+	*/
+	unsigned int poolsize = 2 * m_depth + 3;
+	for ( auto & transform : m_transforms )
+		poolsize += transform->maxHeld();
+	m_toTransform.reset(new SPSCQueue<FramePacket*>(m_depth));
+	m_toWriter.reset(new SPSCQueue<FramePacket*>(m_depth));
+	m_free.reset(new SPSCQueue<FramePacket*>(poolsize));
+	m_pool.clear();
+	for (unsigned int i = 0; i < poolsize; ++i)
+	{
+		m_pool.emplace_back(new FramePacket);
+		m_free->push(m_pool.back().get());
+	}
+	m_failed = false;
+	m_framesWritten = 0;
+	m_partsWritten = 0;
+
+	std::thread writer(&SplitPipeline::writerStage, this);
+	std::thread transformer;
+	if ( ! m_transforms.empty() )
+		transformer = std::thread(&SplitPipeline::transformStage, this);
+	// the reader stage runs on this thread as it owns the libtiff handle
+	readerStage();
+	if ( transformer.joinable() )
+		transformer.join();
+	writer.join();
+	return ! m_failed;
+}
+
+void SplitPipeline::readerStage()
+{
+	SPSCQueue<FramePacket*> & out = m_transforms.empty() ? *m_toWriter : *m_toTransform;
+	FramePacket * packet;
+	const int ndirs = m_plan->numDirs();
+	const bool timed = m_plan->isTimed();
+	FrameTimes times;
+	for (int i = 0; i < ndirs && ! m_failed; ++i)
+	{
+		int part = timed ? 0 : m_plan->partFor(i);
+		if ( part < 0 )
+			continue;
+		m_free->waitPop(packet);
+		packet->dirnum = i;
+		packet->skip = false;
+		packet->eos = false;
+		bool ok = m_reader->readTags(i, packet->swTag, packet->imDescTag);
+		if ( ok )
+			ok = m_crop.empty() ? m_reader->readframe(packet->decoded, i) :
+				m_reader->readRegion(packet->decoded, m_crop, i);
+		if ( ! ok )
+		{
+			std::cout << "Failed to read frame " << i << std::endl;
+			m_failed = true;
+			packet->skip = true;
+		}
+		else
+		{
+			packet->frame = packet->decoded;
+			if ( ! m_crop.empty() )
+			{
+				m_reader->setImageSizeTags(packet->swTag, packet->frame.rows, packet->frame.cols);
+				m_reader->setImageSizeTags(packet->imDescTag, packet->frame.rows, packet->frame.cols);
+			}
+			if ( timed )
+			{
+				// the timing is parsed from the tag just read, as the frame goes past
+				m_reader->parseFrameTimes(packet->imDescTag, times);
+				part = m_plan->timedPart(i, times);
+			}
+		}
+		packet->part = part;
+		packet->partInfo = packet->skip ? nullptr : &m_plan->getPart(part);
+		out.waitPush(packet);
+	}
+	m_free->waitPop(packet);
+	packet->skip = true;
+	packet->eos = true;
+	out.waitPush(packet);
+}
+
+void SplitPipeline::transformStage()
+{
+	std::vector<FramePacket*> current, next;
+	FramePacket * packet;
+	bool done = false;
+	while ( ! done )
+	{
+		m_toTransform->waitPop(packet);
+		current.clear();
+		if ( packet->eos )
+		{
+			/*
+			Flush the transforms in order, feeding whatever each one
+			releases through the ones after it
+			*/
+			for (std::size_t t = 0; t < m_transforms.size(); ++t)
+			{
+				next.clear();
+				for ( auto p : current )
+				{
+					if ( p->skip )
+						next.push_back(p);
+					else
+						m_transforms[t]->process(p, next);
+				}
+				m_transforms[t]->flush(next);
+				current.swap(next);
+			}
+			current.push_back(packet);
+			done = true;
+		}
+		else
+		{
+			current.push_back(packet);
+			for ( auto & transform : m_transforms )
+			{
+				next.clear();
+				for ( auto p : current )
+				{
+					if ( p->skip )
+						next.push_back(p);
+					else
+						transform->process(p, next);
+				}
+				current.swap(next);
+			}
+		}
+		for ( auto p : current )
+			m_toWriter->waitPush(p);
+	}
+}
+
+void SplitPipeline::writerStage()
+{
+	// each stream (see SplitPlan::deinterleave) has a part open at once
+	const int nstreams = m_plan->numStreams();
+	std::vector<std::unique_ptr<cv::TiffWriter>> writers(nstreams);
+	std::vector<std::unique_ptr<RawWriter>> raws(nstreams);
+	std::vector<std::vector<uchar>> memory(nstreams);
+	std::vector<int> currentPart(nstreams, -1);
+	std::vector<const PartPlan*> openPart(nstreams, nullptr);
+	for (int stream = 0; stream < nstreams; ++stream)
+	{
+		writers[stream].reset(new cv::TiffWriter);
+		writers[stream]->setDirectIO(m_directio);
+		raws[stream].reset(new RawWriter);
+		raws[stream]->setDirectIO(m_directio);
+	}
+	std::vector<int> params;
+	if ( m_compression != COMPRESSION_NONE )
+		params = { TIFFTAG_COMPRESSION, m_compression };
+	// raw frames sent to a stream all go into the one sink, whatever part they're in
+	std::unique_ptr<StreamSink> rawStream;
+	if ( m_raw && m_streamfd >= 0 )
+		rawStream.reset(new StreamSink(m_streamfd));
+	std::unique_ptr<SplitManifest> manifest;
+	if ( ! m_manifestFile.empty() )
+		manifest.reset(new SplitManifest(m_reader->getfilename(), ! m_raw));
+	FramePacket * packet;
+	// a part that's in the journal is safely on disk
+	auto journalPart = [&](int stream)
+	{
+		if ( m_journal && ! m_failed && ! m_journal->partDone(currentPart[stream], *openPart[stream]) )
+		{
+			// only means more to do if the split is resumed, so carry on without it
+			std::cout << "WARNING: could not update the journal, the split can't be resumed past here" << std::endl;
+			m_journal = nullptr;
+		}
+	};
+	// close the current part of a stream and, if it's in memory, hand it on
+	auto finishPart = [&](int stream)
+	{
+		if ( rawStream )
+			return;
+		if ( m_raw )
+		{
+			if ( ! raws[stream]->isOpened() )
+				return;
+			if ( ! raws[stream]->close() )
+				m_failed = true;
+			journalPart(stream);
+			return;
+		}
+		if ( ! writers[stream]->isOpened() )
+			return;
+		if ( ! writers[stream]->close() )
+			m_failed = true;
+		const PartPlan & part = *openPart[stream];
+		if ( m_partHandler && ! m_failed && ! m_partHandler(part, memory[stream]) )
+		{
+			std::cout << "Failed to hand on " << part.filename << std::endl;
+			m_failed = true;
+		}
+		else if ( ! m_partHandler && m_streamfd < 0 )
+			journalPart(stream);
+	};
+	while ( true )
+	{
+		m_toWriter->waitPop(packet);
+		if ( packet->eos )
+		{
+			m_free->waitPush(packet);
+			break;
+		}
+		// after a failure keep draining so the reader never blocks
+		if ( ! packet->skip && ! m_failed )
+		{
+			// not m_plan->getPart() as the reader may be adding parts to the plan
+			const PartPlan & part = *packet->partInfo;
+			const int stream = part.stream;
+			cv::TiffWriter & writer = *writers[stream];
+			RawWriter & raw = *raws[stream];
+			if ( packet->part != currentPart[stream] )
+			{
+				finishPart(stream);
+				bool ok;
+				if ( rawStream )
+					ok = true;
+				else if ( m_streamfd >= 0 )
+				{
+					std::cout << "Writing to the output stream" << std::endl;
+					ok = writer.openStream(m_streamfd, part.bigtiff);
+				}
+				else if ( m_raw )
+				{
+					std::cout << "Writing to " << part.filename << std::endl;
+					std::vector<int> channels, planes;
+					m_plan->streamLayout(stream, channels, planes);
+					ok = raw.open(part.filename, channels, planes, m_plan->cyclePosition(packet->dirnum));
+				}
+				else if ( m_partHandler )
+					ok = writer.open(memory[stream], part.bigtiff);
+				else
+				{
+					std::cout << "Writing to " << part.filename << std::endl;
+					ok = writer.open(part.filename, part.bigtiff);
+				}
+				if ( ! ok )
+				{
+					std::cout << "Could not open " << part.filename << " for writing" << std::endl;
+					m_failed = true;
+				}
+				else if ( m_raw )
+					raw.reserve(part.bytes);
+				else
+					writer.reserve(part.bytes);
+				currentPart[stream] = packet->part;
+				openPart[stream] = packet->partInfo;
+				++m_partsWritten;
+			}
+			if ( ! m_failed )
+			{
+				bool ok;
+				if ( m_raw )
+				{
+					// the sidecar or frame header only keeps the timestamps from the tags
+					FrameTimes times;
+					m_reader->parseFrameTimes(packet->imDescTag, times);
+					if ( rawStream )
+					{
+						RawFrameHeader header;
+						int channel, plane;
+						m_plan->channelAndPlane(packet->dirnum, channel, plane);
+						header.dirnum = packet->dirnum;
+						header.channel = channel;
+						header.plane = plane;
+						header.timestamp = times.timestamp;
+						ok = RawWriter::streamFrame(*rawStream, packet->frame, header);
+					}
+					else
+						ok = raw.write(packet->frame, times.timestamp);
+				}
+				else
+				{
+					writer.writeSIHdr(packet->swTag, packet->imDescTag);
+					ok = writer.write(packet->frame, params);
+				}
+				if ( ok && manifest )
+				{
+					manifest->addFrame(m_streamfd >= 0 ? "-" : part.filename, packet->dirnum,
+						SplitManifest::pixelDigest(packet->frame),
+						m_raw ? 0 : SplitManifest::tagDigest(packet->imDescTag, packet->swTag));
+				}
+				if ( ok )
+					++m_framesWritten;
+				else
+				{
+					std::cout << "Failed to write frame " << packet->dirnum << std::endl;
+					m_failed = true;
+				}
+			}
+		}
+		m_free->waitPush(packet);
+	}
+	for (int stream = 0; stream < nstreams; ++stream)
+		finishPart(stream);
+	if ( rawStream && rawStream->close() != 0 )
+		m_failed = true;
+	if ( manifest && ! m_failed )
+	{
+		if ( manifest->write(m_manifestFile) )
+			std::cout << "Checksums saved to " << m_manifestFile << std::endl;
+		else
+		{
+			std::cout << "Failed to write " << m_manifestFile << std::endl;
+			m_failed = true;
+		}
+	}
+}
@@ -0,0 +1,400 @@
+#include "../include/split_plan.h"
+#include "../include/write_tiff.h"
+
+#include <algorithm>
+
+/*
+Classic tiff offsets are 32 bit. The estimates are upper bounds but leave
+some headroom anyway rather than find out at the last frame. Compressed
+parts are always BigTIFFs (see classicAllowed)
+*/
+static const uint64 classicLimit = ((uint64)4 << 30) - ((uint64)64 << 20);
+
+void SplitPlan::deinterleave(const std::vector<int> & channels, int planes, bool byChannel, bool byPlane)
+{
+	m_channels = channels;
+	if ( m_channels.empty() )
+		m_channels.push_back(1);
+	m_planes = std::max(1, planes);
+	m_byChannel = byChannel;
+	m_byPlane = byPlane;
+	m_streamNames.clear();
+	const int nchans = m_byChannel ? m_channels.size() : 1;
+	const int nplanes = m_byPlane ? m_planes : 1;
+	for (int c = 0; c < nchans; ++c)
+	{
+		for (int p = 0; p < nplanes; ++p)
+		{
+			std::string name;
+			if ( m_byChannel )
+				name += "_chan" + std::to_string(m_channels[c]);
+			if ( m_byPlane )
+				name += "_plane" + std::to_string(p + 1);
+			m_streamNames.push_back(name);
+		}
+	}
+}
+
+int SplitPlan::streamFor(unsigned int dirnum) const
+{
+	if ( ! m_byChannel && ! m_byPlane )
+		return 0;
+	const unsigned int nchans = m_channels.size();
+	int chan = dirnum % nchans;
+	int plane = (dirnum / nchans) % m_planes;
+	return (m_byChannel ? chan : 0) * (m_byPlane ? m_planes : 1) + (m_byPlane ? plane : 0);
+}
+
+void SplitPlan::streamLayout(int stream, std::vector<int> & channels, std::vector<int> & planes) const
+{
+	channels.clear();
+	planes.clear();
+	const int nplanes = m_byPlane ? m_planes : 1;
+	if ( m_channels.empty() )
+		channels.push_back(1);
+	else if ( m_byChannel )
+		channels.push_back(m_channels[stream / nplanes]);
+	else
+		channels = m_channels;
+	if ( m_byPlane )
+		planes.push_back(stream % nplanes + 1);
+	else
+		for (int p = 0; p < m_planes; ++p)
+			planes.push_back(p + 1);
+}
+
+int SplitPlan::binCycle() const
+{
+	const int nchans = std::max<std::size_t>(1, m_channels.size());
+	return ( m_byChannel ? 1 : nchans ) * ( m_byPlane ? 1 : m_planes );
+}
+
+void SplitPlan::BinState::add(int bin, int part)
+{
+	if ( parts[bin] != part )
+	{
+		parts[bin] = part;
+		frames[bin] = 0;
+	}
+	++frames[bin];
+}
+
+int SplitPlan::cyclePosition(unsigned int dirnum) const
+{
+	const unsigned int nchans = std::max<std::size_t>(1, m_channels.size());
+	int chan = dirnum % nchans;
+	int plane = (dirnum / nchans) % m_planes;
+	return ( m_byChannel ? 0 : chan ) + ( m_byPlane ? 0 : plane ) * ( m_byChannel ? 1 : nchans );
+}
+
+void SplitPlan::channelAndPlane(unsigned int dirnum, int & channel, int & plane) const
+{
+	const unsigned int nchans = std::max<std::size_t>(1, m_channels.size());
+	channel = m_channels.empty() ? 1 : m_channels[dirnum % nchans];
+	plane = (dirnum / nchans) % m_planes + 1;
+}
+
+std::string SplitPlan::partName(int stream, int part) const
+{
+	return m_outputBase + m_streamNames[stream] + "_part" + std::to_string(part) + ( m_raw ? ".bin" : ".tif" );
+}
+
+uint64 SplitPlan::headerBytes(bool bigtiff) const
+{
+	return m_raw ? 0 : cv::TiffWriter::headerBytes(bigtiff);
+}
+
+uint32 SplitPlan::SharedTags::add(uint32 len, std::size_t hash, bool imDesc)
+{
+	if ( len > 0 && ( ( len == imDescLen && hash == imDescHash ) || ( len == swLen && hash == swHash ) ) )
+		return 0;
+	if ( imDesc )
+	{
+		imDescLen = len;
+		imDescHash = hash;
+	}
+	else
+	{
+		swLen = len;
+		swHash = hash;
+	}
+	return len;
+}
+
+uint64 SplitPlan::frameBytes(const DirInfo & info, int part, bool bigtiff) const
+{
+	SharedTags shared = part >= 0 ? m_shared[part] : SharedTags();
+	return frameBytes(info, shared, bigtiff);
+}
+
+uint64 SplitPlan::frameBytes(const DirInfo & info, SharedTags & shared, bool bigtiff) const
+{
+	uint32 width = info.width, height = info.height;
+	if ( ! m_crop.empty() )
+	{
+		cv::Rect roi = m_crop & cv::Rect(0, 0, width, height);
+		width = roi.width;
+		height = roi.height;
+	}
+	if ( m_spatialBin > 1 && width >= (uint32)m_spatialBin && height >= (uint32)m_spatialBin )
+	{
+		width /= m_spatialBin;
+		height /= m_spatialBin;
+	}
+	const int bits = m_bitsPerSample > 0 ? m_bitsPerSample : info.bitsPerSample;
+	// nothing but the pixels
+	if ( m_raw )
+		return (uint64)width * height * info.samplesPerPixel * ( ( bits + 7 ) / 8 );
+	// same order as TiffWriter::writeSIHdr
+	uint32 imDescLen = shared.add(info.imDescLen, info.imDescHash, true);
+	uint32 swLen = shared.add(info.swLen, info.swHash, false);
+	// binning rewrites the timestamp in the ImageDescription, which may come out longer
+	if ( m_bin > 1 && imDescLen > 0 )
+		imDescLen += 32;
+	return cv::TiffWriter::estimateFrameBytes(width, height, bits,
+		info.samplesPerPixel, imDescLen, swLen, bigtiff, m_compression);
+}
+
+void SplitPlan::clear(unsigned int ndirs)
+{
+	m_parts.clear();
+	m_classicBytes.clear();
+	m_shared.clear();
+	m_timed = false;
+	m_streamParts.assign(m_streamNames.size(), 0);
+	m_dirToPart.assign(ndirs, -1);
+}
+
+int SplitPlan::newPart(int stream)
+{
+	PartPlan part;
+	part.stream = stream;
+	part.index = m_streamParts[stream]++;
+	part.filename = partName(stream, part.index);
+	part.bytes = headerBytes(true);
+	m_parts.push_back(part);
+	m_classicBytes.push_back(headerBytes(false));
+	m_shared.push_back(SharedTags());
+	return m_parts.size() - 1;
+}
+
+void SplitPlan::addToPart(int part, unsigned int dirnum, const DirInfo & info, bool written)
+{
+	PartPlan & plan = m_parts[part];
+	if ( plan.nframes == 0 )
+		plan.firstDir = dirnum;
+	plan.lastDir = dirnum;
+	m_dirToPart[dirnum] = part;
+	if ( ! written )
+		return;
+	++plan.nframes;
+	SharedTags before = m_shared[part];
+	plan.bytes += frameBytes(info, m_shared[part], true);
+	m_classicBytes[part] += frameBytes(info, before, false);
+}
+
+void SplitPlan::chooseFormats()
+{
+	for (unsigned int i = 0; i < m_parts.size(); ++i)
+	{
+		m_parts[i].bigtiff = ! classicAllowed() || m_classicBytes[i] > classicLimit;
+		if ( ! m_parts[i].bigtiff )
+			m_parts[i].bytes = m_classicBytes[i];
+	}
+}
+
+bool SplitPlan::byFrames(const std::vector<DirInfo> & dirs, int chunkSize)
+{
+	if ( chunkSize < 1 )
+		return false;
+	clear(dirs.size());
+	// the current part and the number of frames written to it so far in each stream
+	std::vector<int> current(numStreams(), -1);
+	std::vector<int> count(numStreams(), 0);
+	BinState bins(numBins());
+	for (unsigned int i = 0; i < dirs.size(); ++i)
+	{
+		const int stream = streamFor(i);
+		const int bin = binFor(i);
+		// a full part is left once the bins in it are, as each new one starts
+		if ( current[stream] < 0 || ( count[stream] == chunkSize && bins.starts(bin, current[stream], m_bin) ) )
+		{
+			current[stream] = newPart(stream);
+			count[stream] = 0;
+		}
+		const bool written = bins.starts(bin, current[stream], m_bin);
+		bins.add(bin, current[stream]);
+		if ( written )
+			++count[stream];
+		addToPart(current[stream], i, dirs[i], written);
+	}
+	chooseFormats();
+	return ! m_parts.empty();
+}
+
+bool SplitPlan::byBytes(const std::vector<DirInfo> & dirs, uint64 maxBytes)
+{
+	clear(dirs.size());
+	// the parts will all be classic tiffs if the budget is small enough for that
+	const bool bigtiff = ! classicAllowed() || maxBytes > classicLimit;
+	const uint64 header = headerBytes(bigtiff);
+	// the current part and the bytes used in it for each stream
+	std::vector<int> current(numStreams(), -1);
+	std::vector<uint64> used(numStreams(), 0);
+	BinState bins(numBins());
+	for (unsigned int i = 0; i < dirs.size(); ++i)
+	{
+		const int stream = streamFor(i);
+		const int bin = binFor(i);
+		// only the first frame of a bin takes up any room
+		if ( ! bins.starts(bin, current[stream], m_bin) )
+		{
+			bins.add(bin, current[stream]);
+			addToPart(current[stream], i, dirs[i], false);
+			continue;
+		}
+		uint64 frame = frameBytes(dirs[i], current[stream], bigtiff);
+		if ( current[stream] < 0 || used[stream] + frame > maxBytes )
+		{
+			// the first frame of a part can't share anything
+			frame = frameBytes(dirs[i], -1, bigtiff);
+			if ( header + frame > maxBytes )
+			{
+				std::cout << "Frame " << i << " needs " << header + frame << " bytes on its own, more than the " << maxBytes << " allowed per file" << std::endl;
+				m_parts.clear();
+				return false;
+			}
+			current[stream] = newPart(stream);
+			used[stream] = header;
+		}
+		bins.add(bin, current[stream]);
+		addToPart(current[stream], i, dirs[i]);
+		used[stream] += frame;
+	}
+	chooseFormats();
+	return ! m_parts.empty();
+}
+
+bool SplitPlan::byTime(const std::vector<DirInfo> & dirs, double seconds, bool onTriggers)
+{
+	if ( seconds <= 0 && ! onTriggers )
+		return false;
+	clear(dirs.size());
+	m_timed = true;
+	m_seconds = seconds;
+	m_onTriggers = onTriggers;
+	m_timing = TimedState();
+	m_streamWindow.assign(numStreams(), std::make_pair(-1, -1L));
+	m_streamCurrent.assign(numStreams(), -1);
+	m_timedBins = BinState(numBins());
+	/*
+	How big a part starting at each directory could possibly get, so parts
+	can still be written as classic tiffs when the rest of their stream
+	would fit in one
+	*/
+	m_remainingClassic.assign(dirs.size(), 0);
+	std::vector<uint64> streamTotal(numStreams(), headerBytes(false));
+	for (unsigned int i = dirs.size(); i-- > 0; )
+	{
+		int stream = streamFor(i);
+		streamTotal[stream] += frameBytes(dirs[i], -1, false);
+		m_remainingClassic[i] = streamTotal[stream];
+	}
+	return ! dirs.empty();
+}
+
+int SplitPlan::timedPart(unsigned int dirnum, const FrameTimes & times)
+{
+	if ( dirnum >= m_dirToPart.size() )
+		return -1;
+	// a frame with a corrupt header just goes wherever the last one went
+	double timestamp = times.timestamp >= 0 ? times.timestamp : m_timing.lastTimestamp;
+	if ( ! m_timing.started )
+	{
+		m_timing.started = true;
+		m_timing.epochStart = timestamp;
+	}
+	else if ( m_onTriggers )
+	{
+		// a trigger shows up as a new value in the header from that frame on
+		auto fired = [](const std::string & now, const std::string & before)
+		{
+			return now != before && now.find_first_of("0123456789") != std::string::npos;
+		};
+		if ( fired(times.acqTriggers, m_timing.last.acqTriggers) ||
+			fired(times.nextFileMarkers, m_timing.last.nextFileMarkers) )
+		{
+			++m_timing.epoch;
+			m_timing.epochStart = timestamp;
+		}
+	}
+	m_timing.lastTimestamp = timestamp;
+	m_timing.last = times;
+
+	long window = m_seconds > 0 ? (long)((timestamp - m_timing.epochStart) / m_seconds) : 0;
+	std::pair<int, long> key(m_timing.epoch, window);
+	int stream = streamFor(dirnum);
+	if ( m_streamCurrent[stream] < 0 || m_streamWindow[stream] != key )
+	{
+		/*
+		The writer may already be using the other parts so this one is
+		filled in completely before it's handed over and only the frame
+		counts are touched afterwards. There's no size to reserve
+		*/
+		int part = newPart(stream);
+		m_parts[part].bigtiff = ! classicAllowed() || m_remainingClassic[dirnum] > classicLimit;
+		m_parts[part].bytes = 0;
+		m_parts[part].firstDir = dirnum;
+		m_streamCurrent[stream] = part;
+		m_streamWindow[stream] = key;
+	}
+	int part = m_streamCurrent[stream];
+	m_parts[part].lastDir = dirnum;
+	const int bin = binFor(dirnum);
+	if ( m_timedBins.starts(bin, part, m_bin) )
+		++m_parts[part].nframes;
+	m_timedBins.add(bin, part);
+	m_dirToPart[dirnum] = part;
+	return part;
+}
+
+void SplitPlan::sizeTimedParts(const std::vector<DirInfo> & dirs)
+{
+	for (std::size_t part = 0; part < m_parts.size(); ++part)
+	{
+		m_parts[part].bytes = headerBytes(m_parts[part].bigtiff);
+		m_shared[part] = SharedTags();
+	}
+	// only the frames that start a bin are written, as timedPart counted them
+	BinState bins(numBins());
+	for (unsigned int i = 0; i < dirs.size() && i < m_dirToPart.size(); ++i)
+	{
+		const int part = m_dirToPart[i];
+		if ( part < 0 )
+			continue;
+		const int bin = binFor(i);
+		if ( bins.starts(bin, part, m_bin) )
+			m_parts[part].bytes += frameBytes(dirs[i], m_shared[part], m_parts[part].bigtiff);
+		bins.add(bin, part);
+	}
+}
+
+int SplitPlan::partFor(unsigned int dirnum) const
+{
+	if ( dirnum < m_dirToPart.size() )
+		return m_dirToPart[dirnum];
+	return -1;
+}
+
+void SplitPlan::skipPart(int part)
+{
+	std::replace(m_dirToPart.begin(), m_dirToPart.end(), part, -1);
+}
+
+uint64 SplitPlan::totalBytes() const
+{
+	uint64 total = 0;
+	for ( auto & part : m_parts )
+		total += part.bytes;
+	return total;
+}
@@ -0,0 +1,407 @@
+#include "../include/tiff_io.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <iostream>
+
+// libtiff calls back into the sink through these
+static tmsize_t sinkRead(thandle_t handle, void * buf, tmsize_t size)
+{
+	return static_cast<TiffSink*>(handle)->read(buf, size);
+}
+
+static tmsize_t sinkWrite(thandle_t handle, void * buf, tmsize_t size)
+{
+	return static_cast<TiffSink*>(handle)->write(buf, size);
+}
+
+static toff_t sinkSeek(thandle_t handle, toff_t offset, int whence)
+{
+	return static_cast<TiffSink*>(handle)->seek(offset, whence);
+}
+
+static int sinkClose(thandle_t handle)
+{
+	return static_cast<TiffSink*>(handle)->close();
+}
+
+static toff_t sinkSize(thandle_t handle)
+{
+	return static_cast<TiffSink*>(handle)->size();
+}
+
+// none of the sinks can be memory mapped
+static int sinkMap(thandle_t, void **, toff_t *)
+{
+	return 0;
+}
+
+static void sinkUnmap(thandle_t, void *, toff_t) {}
+
+TIFF * TiffSink::openTiff(const std::string & name, const char * mode)
+{
+	return TIFFClientOpen(name.c_str(), mode, static_cast<thandle_t>(this),
+		sinkRead, sinkWrite, sinkSeek, sinkClose, sinkSize, sinkMap, sinkUnmap);
+}
+
+/* -----------------------------------------------------------
+class DirectFileSink
+------------------------------------------------------------*/
+DirectFileSink::DirectFileSink(size_t blockSize)
+{
+	// whole number of alignment units
+	m_blockSize = ((blockSize + alignment - 1) / alignment) * alignment;
+	if ( m_blockSize == 0 )
+		m_blockSize = alignment;
+}
+
+DirectFileSink::~DirectFileSink()
+{
+	close();
+	free(m_buf);
+	free(m_cache);
+}
+
+bool DirectFileSink::open(const std::string & filename)
+{
+	close();
+	if ( ! m_buf && posix_memalign((void**)&m_buf, alignment, m_blockSize) != 0 )
+		m_buf = nullptr;
+	if ( ! m_cache && posix_memalign((void**)&m_cache, alignment, alignment * cacheBlocks) != 0 )
+		m_cache = nullptr;
+	if ( ! m_buf || ! m_cache )
+		return false;
+	std::fill(m_cacheOffset, m_cacheOffset + cacheBlocks, ~(uint64)0);
+	m_direct = true;
+	m_fd = ::open(filename.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_DIRECT, 0644);
+	if ( m_fd < 0 )
+	{
+		std::cout << "O_DIRECT not supported for " << filename << ", using buffered writes instead" << std::endl;
+		m_direct = false;
+		m_fd = ::open(filename.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+	}
+	m_bufStart = m_pos = m_size = 0;
+	return m_fd >= 0;
+}
+
+bool DirectFileSink::flushBlock()
+{
+	if ( pwrite(m_fd, m_buf, m_blockSize, m_bufStart) != (ssize_t)m_blockSize )
+		return false;
+	if ( ! m_direct )
+	{
+		// pages have to be clean before the kernel will drop them
+		sync_file_range(m_fd, m_bufStart, m_blockSize,
+			SYNC_FILE_RANGE_WAIT_BEFORE | SYNC_FILE_RANGE_WRITE | SYNC_FILE_RANGE_WAIT_AFTER);
+		posix_fadvise(m_fd, m_bufStart, m_blockSize, POSIX_FADV_DONTNEED);
+	}
+	m_bufStart += m_blockSize;
+	return true;
+}
+
+unsigned char * DirectFileSink::diskBlock(uint64 block)
+{
+	for (int i = 0; i < cacheBlocks; ++i)
+	{
+		if ( m_cacheOffset[i] == block )
+			return m_cache + i * alignment;
+	}
+	const int slot = m_cacheNext;
+	m_cacheNext = ( m_cacheNext + 1 ) % cacheBlocks;
+	unsigned char * data = m_cache + slot * alignment;
+	// everything before m_bufStart went out in whole blocks so this is always a full read
+	m_cacheOffset[slot] = ~(uint64)0;
+	if ( pread(m_fd, data, alignment, block) != (ssize_t)alignment )
+		return nullptr;
+	m_cacheOffset[slot] = block;
+	return data;
+}
+
+bool DirectFileSink::readDisk(uint64 pos, unsigned char * data, size_t len)
+{
+	while ( len > 0 )
+	{
+		uint64 block = pos - (pos % alignment);
+		size_t offset = pos - block;
+		size_t n = std::min(len, alignment - offset);
+		const unsigned char * cached = diskBlock(block);
+		if ( ! cached )
+			return false;
+		memcpy(data, cached + offset, n);
+		pos += n;
+		data += n;
+		len -= n;
+	}
+	return true;
+}
+
+bool DirectFileSink::patchDisk(uint64 pos, const unsigned char * data, size_t len)
+{
+	while ( len > 0 )
+	{
+		uint64 block = pos - (pos % alignment);
+		size_t offset = pos - block;
+		size_t n = std::min(len, alignment - offset);
+		unsigned char * cached = diskBlock(block);
+		if ( ! cached )
+			return false;
+		memcpy(cached + offset, data, n);
+		if ( pwrite(m_fd, cached, alignment, block) != (ssize_t)alignment )
+			return false;
+		pos += n;
+		data += n;
+		len -= n;
+	}
+	return true;
+}
+
+tmsize_t DirectFileSink::write(const void * buf, tmsize_t size)
+{
+	if ( m_fd < 0 || size < 0 )
+		return -1;
+	// fill any gap left by seeking past the end (libtiff word-aligns IFDs that way)
+	if ( m_pos > m_size )
+	{
+		static const unsigned char zeros[16] = {0};
+		uint64 target = m_pos;
+		m_pos = m_size;
+		while ( m_pos < target )
+		{
+			if ( write(zeros, std::min<uint64>(sizeof(zeros), target - m_pos)) < 0 )
+				return -1;
+		}
+	}
+	const unsigned char * data = static_cast<const unsigned char*>(buf);
+	size_t len = size;
+	// anything landing before the staging buffer is already on disk
+	if ( m_pos < m_bufStart )
+	{
+		size_t n = std::min<uint64>(len, m_bufStart - m_pos);
+		if ( ! patchDisk(m_pos, data, n) )
+			return -1;
+		m_pos += n;
+		data += n;
+		len -= n;
+	}
+	while ( len > 0 )
+	{
+		size_t offset = m_pos - m_bufStart;
+		size_t n = std::min(len, m_blockSize - offset);
+		memcpy(m_buf + offset, data, n);
+		m_pos += n;
+		data += n;
+		len -= n;
+		if ( m_pos > m_size )
+			m_size = m_pos;
+		if ( m_pos - m_bufStart == m_blockSize && ! flushBlock() )
+			return -1;
+	}
+	return size;
+}
+
+tmsize_t DirectFileSink::read(void * buf, tmsize_t size)
+{
+	if ( m_fd < 0 || size < 0 )
+		return -1;
+	unsigned char * data = static_cast<unsigned char*>(buf);
+	if ( m_pos >= m_size )
+		return 0;
+	size_t len = std::min<uint64>(size, m_size - m_pos);
+	const size_t total = len;
+	if ( m_pos < m_bufStart )
+	{
+		size_t n = std::min<uint64>(len, m_bufStart - m_pos);
+		if ( ! readDisk(m_pos, data, n) )
+			return -1;
+		m_pos += n;
+		data += n;
+		len -= n;
+	}
+	memcpy(data, m_buf + (m_pos - m_bufStart), len);
+	m_pos += len;
+	return total;
+}
+
+toff_t DirectFileSink::seek(toff_t offset, int whence)
+{
+	uint64 pos;
+	switch ( whence )
+	{
+		case SEEK_SET: pos = offset; break;
+		case SEEK_CUR: pos = m_pos + offset; break;
+		case SEEK_END: pos = m_size + offset; break;
+		default: return (toff_t)-1;
+	}
+	m_pos = pos;
+	return m_pos;
+}
+
+int DirectFileSink::close()
+{
+	if ( m_fd < 0 )
+		return 0;
+	int result = 0;
+	size_t tail = m_size - m_bufStart;
+	if ( tail > 0 )
+	{
+		// pad out to a whole block for O_DIRECT then cut the file back to size
+		size_t padded = ((tail + alignment - 1) / alignment) * alignment;
+		memset(m_buf + tail, 0, padded - tail);
+		if ( pwrite(m_fd, m_buf, padded, m_bufStart) != (ssize_t)padded ||
+			ftruncate(m_fd, m_size) != 0 )
+			result = -1;
+	}
+	if ( ::close(m_fd) != 0 )
+		result = -1;
+	m_fd = -1;
+	return result;
+}
+
+/* -----------------------------------------------------------
+class MemorySink
+------------------------------------------------------------*/
+tmsize_t MemorySink::read(void * buf, tmsize_t size)
+{
+	if ( size < 0 )
+		return -1;
+	if ( m_pos >= m_buf.size() )
+		return 0;
+	size_t n = std::min<uint64>(size, m_buf.size() - m_pos);
+	memcpy(buf, m_buf.data() + m_pos, n);
+	m_pos += n;
+	return n;
+}
+
+tmsize_t MemorySink::write(const void * buf, tmsize_t size)
+{
+	if ( size < 0 )
+		return -1;
+	// vector's geometric growth keeps appending a frame at a time cheap
+	if ( m_pos + size > m_buf.size() )
+		m_buf.resize(m_pos + size);
+	memcpy(m_buf.data() + m_pos, buf, size);
+	m_pos += size;
+	return size;
+}
+
+toff_t MemorySink::seek(toff_t offset, int whence)
+{
+	switch ( whence )
+	{
+		case SEEK_SET: m_pos = offset; break;
+		case SEEK_CUR: m_pos += offset; break;
+		case SEEK_END: m_pos = m_buf.size() + offset; break;
+		default: return (toff_t)-1;
+	}
+	return m_pos;
+}
+
+/* -----------------------------------------------------------
+class StreamSink
+------------------------------------------------------------*/
+StreamSink::StreamSink(int fd, size_t blockSize) : m_fd(fd), m_blockSize(blockSize)
+{
+#ifdef F_SETPIPE_SZ
+	// a bigger pipe means fewer stalls handing over each block (fails harmlessly if fd isn't a pipe)
+	fcntl(m_fd, F_SETPIPE_SZ, 1 << 20);
+#endif
+	m_buf.reserve(m_blockSize);
+}
+
+bool StreamSink::flush(size_t len)
+{
+	const unsigned char * data = m_buf.data();
+	size_t left = len;
+	while ( left > 0 && ! m_failed )
+	{
+		ssize_t n = ::write(m_fd, data, left);
+		if ( n > 0 )
+		{
+			data += n;
+			left -= n;
+		}
+		else if ( n < 0 && errno == EAGAIN )
+		{
+			// a non-blocking descriptor - wait for the reader to catch up
+			struct pollfd pfd = { m_fd, POLLOUT, 0 };
+			poll(&pfd, 1, -1);
+		}
+		else if ( n < 0 && errno == EINTR )
+			continue;
+		else
+			m_failed = true;
+	}
+	if ( m_failed )
+	{
+		std::cout << "Failed to write to the output stream" << std::endl;
+		return false;
+	}
+	m_buf.erase(m_buf.begin(), m_buf.begin() + len);
+	m_bufStart += len;
+	return true;
+}
+
+void StreamSink::commit(uint64 offset)
+{
+	m_committed = std::max(m_committed, std::min(offset, m_size));
+	if ( m_committed - m_bufStart >= m_blockSize )
+		flush(m_committed - m_bufStart);
+}
+
+tmsize_t StreamSink::write(const void * buf, tmsize_t size)
+{
+	if ( m_failed || size < 0 )
+		return -1;
+	if ( m_pos < m_bufStart )
+	{
+		std::cout << "Can't go back to offset " << m_pos << " of the output stream, it's already been written" << std::endl;
+		return -1;
+	}
+	// anything past the end, including a gap left by seeking beyond it, extends the buffer
+	const size_t offset = m_pos - m_bufStart;
+	if ( offset + size > m_buf.size() )
+		m_buf.resize(offset + size);
+	memcpy(m_buf.data() + offset, buf, size);
+	m_pos += size;
+	m_size = std::max(m_size, m_pos);
+	return size;
+}
+
+tmsize_t StreamSink::read(void * buf, tmsize_t size)
+{
+	if ( m_failed || size < 0 || m_pos < m_bufStart )
+		return -1;
+	if ( m_pos >= m_size )
+		return 0;
+	size_t n = std::min<uint64>(size, m_size - m_pos);
+	memcpy(buf, m_buf.data() + (m_pos - m_bufStart), n);
+	m_pos += n;
+	return n;
+}
+
+toff_t StreamSink::seek(toff_t offset, int whence)
+{
+	switch ( whence )
+	{
+		case SEEK_SET: m_pos = offset; break;
+		case SEEK_CUR: m_pos += offset; break;
+		case SEEK_END: m_pos = m_size + offset; break;
+		default: return (toff_t)-1;
+	}
+	return m_pos;
+}
+
+int StreamSink::close()
+{
+	if ( m_failed )
+		return -1;
+	if ( ! m_buf.empty() && ! flush(m_buf.size()) )
+		return -1;
+	m_committed = m_bufStart;
+	return 0;
+}
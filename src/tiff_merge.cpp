@@ -0,0 +1,71 @@
+#include "../include/tiff_merge.h"
+
+#include <sys/stat.h>
+
+bool TiffMerger::run()
+{
+	m_framesWritten = 0;
+	if ( m_inputs.empty() )
+		return false;
+	cv::TiffWriter writer;
+	writer.setDirectIO(m_directio);
+	if ( ! writer.open(m_outputFile, true) )
+	{
+		std::cout << "Could not open " << m_outputFile << " for writing" << std::endl;
+		return false;
+	}
+	// the output is never bigger than the inputs put together
+	uint64 total = 0;
+	for ( auto & input : m_inputs )
+	{
+		struct stat st;
+		if ( stat(input.c_str(), &st) == 0 )
+			total += st.st_size;
+	}
+	writer.reserve(total);
+	bool ok = true;
+	for ( auto & input : m_inputs )
+	{
+		if ( ! appendFile(writer, input) )
+		{
+			ok = false;
+			break;
+		}
+	}
+	if ( ! writer.close() )
+		ok = false;
+	return ok;
+}
+
+bool TiffMerger::appendFile(cv::TiffWriter & writer, const std::string & filename)
+{
+	TIFF * tif = TIFFOpen(filename.c_str(), "r");
+	if ( ! tif )
+	{
+		std::cout << "Could not open " << filename << std::endl;
+		return false;
+	}
+	std::cout << "Adding " << filename << std::endl;
+	bool ok = true;
+	while ( true )
+	{
+		if ( ! writer.copyDirectory(tif) )
+		{
+			std::cout << "Failed to copy directory " << TIFFCurrentDirectory(tif) << " of " << filename << std::endl;
+			ok = false;
+			break;
+		}
+		++m_framesWritten;
+		// only the end of the chain is the end of the file, anything else stopping the read is an error
+		if ( TIFFLastDirectory(tif) )
+			break;
+		if ( TIFFReadDirectory(tif) != 1 )
+		{
+			std::cout << "Failed to read directory " << TIFFCurrentDirectory(tif) + 1 << " of " << filename << std::endl;
+			ok = false;
+			break;
+		}
+	}
+	TIFFClose(tif);
+	return ok;
+}
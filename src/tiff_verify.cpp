@@ -0,0 +1,205 @@
+#include "../include/tiff_verify.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <iostream>
+#include <thread>
+
+#include "../include/crc32c.h"
+#include "../include/manifest.h"
+
+// more than this and only the count is given
+static const unsigned int maxReported = 20;
+
+bool TiffVerifier::run()
+{
+	m_framesChecked = 0;
+	m_mismatches = 0;
+	if ( m_parts.empty() )
+	{
+		std::cout << "There are no parts to verify" << std::endl;
+		return false;
+	}
+	// the source first so it gets a thread to itself from the start
+	std::vector<FileDigests> files(m_parts.size() + 1);
+	files[0].filename = m_source;
+	for (std::size_t i = 0; i < m_parts.size(); ++i)
+		files[i + 1].filename = m_parts[i];
+	std::cout << "Verifying " << m_parts.size() << " parts against " << m_source << std::endl;
+	std::atomic<std::size_t> next(0);
+	auto worker = [&]() {
+		for (std::size_t i = next++; i < files.size(); i = next++)
+			digestFile(files[i], i == 0 ? m_version : 1);
+	};
+	std::vector<std::thread> threads;
+	const std::size_t count = std::min<std::size_t>(m_threads, files.size());
+	for (std::size_t t = 0; t < count; ++t)
+		threads.emplace_back(worker);
+	for ( auto & thread : threads )
+		thread.join();
+	for ( auto & file : files )
+	{
+		if ( ! file.ok )
+			return false;
+	}
+
+	const std::vector<FrameDigest> & source = files[0].frames;
+	std::size_t dirnum = 0;
+	for (std::size_t p = 1; p < files.size(); ++p)
+	{
+		const FileDigests & part = files[p];
+		for (std::size_t frame = 0; frame < part.frames.size(); ++frame, ++dirnum)
+		{
+			if ( dirnum >= source.size() )
+			{
+				mismatch(part.filename, frame, dirnum, "is past the end of the source");
+				continue;
+			}
+			const FrameDigest & a = source[dirnum];
+			const FrameDigest & b = part.frames[frame];
+			++m_framesChecked;
+			if ( a.width != b.width || a.height != b.height )
+				mismatch(part.filename, frame, dirnum, "is " + std::to_string(b.width) + "x" + std::to_string(b.height) +
+					", not " + std::to_string(a.width) + "x" + std::to_string(a.height));
+			else if ( a.bitsPerSample != b.bitsPerSample || a.samplesPerPixel != b.samplesPerPixel )
+				mismatch(part.filename, frame, dirnum, "has a different pixel type");
+			else if ( a.pixels != b.pixels )
+				mismatch(part.filename, frame, dirnum, "has different pixels");
+			else if ( a.tags != b.tags )
+				mismatch(part.filename, frame, dirnum, "has different tags");
+		}
+	}
+	if ( m_mismatches > maxReported )
+		std::cout << "... and " << m_mismatches - maxReported << " more" << std::endl;
+	bool ok = m_mismatches == 0;
+	if ( dirnum != source.size() )
+	{
+		std::cout << "The parts hold " << dirnum << " frames but " << m_source << " has " << source.size() << std::endl;
+		ok = false;
+	}
+	if ( ok )
+		std::cout << "All " << m_framesChecked << " frames match" << std::endl;
+	else if ( m_mismatches > 0 )
+		std::cout << m_mismatches << " of " << dirnum << " frames don't match" << std::endl;
+	return ok;
+}
+
+void TiffVerifier::mismatch(const std::string & part, unsigned int frame, unsigned int dirnum, const std::string & what)
+{
+	if ( ++m_mismatches <= maxReported )
+		std::cout << "Frame " << frame << " of " << part << " (directory " << dirnum << " of the source) " << what << std::endl;
+}
+
+void TiffVerifier::digestFile(FileDigests & file, int version)
+{
+	TIFF * tif = TIFFOpen(file.filename.c_str(), "r");
+	if ( ! tif )
+	{
+		std::cout << "Could not open " << file.filename << std::endl;
+		return;
+	}
+	std::vector<unsigned char> buffer;
+	file.ok = true;
+	while ( true )
+	{
+		FrameDigest digest;
+		if ( ! digestDirectory(tif, version, digest, buffer) )
+		{
+			std::cout << "Failed to read directory " << TIFFCurrentDirectory(tif) << " of " << file.filename << std::endl;
+			file.ok = false;
+			break;
+		}
+		file.frames.push_back(digest);
+		// a directory that can't be read is an error, not the end of the file
+		if ( TIFFLastDirectory(tif) )
+			break;
+		if ( TIFFReadDirectory(tif) != 1 )
+		{
+			std::cout << "Failed to read directory " << file.frames.size() << " of " << file.filename << std::endl;
+			file.ok = false;
+			break;
+		}
+	}
+	TIFFClose(tif);
+}
+
+bool TiffVerifier::digestDirectory(TIFF * tif, int version, FrameDigest & digest, std::vector<unsigned char> & buffer)
+{
+	uint16 compression = COMPRESSION_NONE;
+	char * imDesc = nullptr;
+	char * sw = nullptr;
+	if ( ! TIFFGetField(tif, TIFFTAG_IMAGEWIDTH, &digest.width) || ! TIFFGetField(tif, TIFFTAG_IMAGELENGTH, &digest.height) )
+		return false;
+	if ( digest.width == 0 || digest.height == 0 )
+		return false;
+	TIFFGetFieldDefaulted(tif, TIFFTAG_BITSPERSAMPLE, &digest.bitsPerSample);
+	TIFFGetFieldDefaulted(tif, TIFFTAG_SAMPLESPERPIXEL, &digest.samplesPerPixel);
+	TIFFGetFieldDefaulted(tif, TIFFTAG_COMPRESSION, &compression);
+	TIFFGetField(tif, TIFFTAG_IMAGEDESCRIPTION, &imDesc);
+	TIFFGetField(tif, TIFFTAG_SOFTWARE, &sw);
+	// the same digest the manifest gives, of the tags as a split writes them
+	const std::string imDescTag = imDesc ? imDesc : "";
+	if ( version == 0 )
+		digest.tags = SplitManifest::tagDigest(imDescTag, imDescTag);
+	else if ( version == 1 )
+		digest.tags = SplitManifest::tagDigest(imDescTag, sw ? sw : "");
+	else
+		digest.tags = SplitManifest::tagDigest(imDescTag, "");
+
+	const tmsize_t rowBytes = TIFFScanlineSize(tif);
+	uint32 crc = 0;
+	if ( TIFFIsTiled(tif) )
+	{
+		// put the tiles back together into rows
+		uint32 tileWidth = 0, tileHeight = 0;
+		TIFFGetField(tif, TIFFTAG_TILEWIDTH, &tileWidth);
+		TIFFGetField(tif, TIFFTAG_TILELENGTH, &tileHeight);
+		const tmsize_t tileBytes = TIFFTileSize(tif);
+		const tmsize_t tileRowBytes = TIFFTileRowSize(tif);
+		if ( tileWidth == 0 || tileHeight == 0 || tileBytes <= 0 || rowBytes <= 0 )
+			return false;
+		std::vector<unsigned char> rows((std::size_t)rowBytes * tileHeight);
+		buffer.resize(tileBytes);
+		const std::size_t pixelBytes = (std::size_t)tileRowBytes / tileWidth;
+		for (uint32 y = 0; y < digest.height; y += tileHeight)
+		{
+			const uint32 height = std::min(tileHeight, digest.height - y);
+			for (uint32 x = 0; x < digest.width; x += tileWidth)
+			{
+				if ( TIFFReadEncodedTile(tif, TIFFComputeTile(tif, x, y, 0, 0), buffer.data(), tileBytes) < 0 )
+					return false;
+				const std::size_t width = std::min(tileWidth, digest.width - x) * pixelBytes;
+				for (uint32 row = 0; row < height; ++row)
+					memcpy(&rows[row * rowBytes + x * pixelBytes], &buffer[row * tileRowBytes], width);
+			}
+			crc = crc32c(crc, rows.data(), (std::size_t)rowBytes * height);
+		}
+	}
+	else
+	{
+		// an uncompressed strip in our own byte order already is the pixels
+		const bool raw = compression == COMPRESSION_NONE && ! TIFFIsByteSwapped(tif);
+		uint32 rowsPerStrip = digest.height;
+		TIFFGetFieldDefaulted(tif, TIFFTAG_ROWSPERSTRIP, &rowsPerStrip);
+		rowsPerStrip = std::min(std::max<uint32>(rowsPerStrip, 1), digest.height);
+		buffer.resize(std::max<tmsize_t>(TIFFStripSize(tif), 1));
+		const uint32 strips = TIFFNumberOfStrips(tif);
+		// separate planes each have a full set of strips
+		const uint32 stripsPerPlane = (digest.height + rowsPerStrip - 1) / rowsPerStrip;
+		for (uint32 strip = 0; strip < strips; ++strip)
+		{
+			const uint32 first = (strip % stripsPerPlane) * rowsPerStrip;
+			const uint32 rows = std::min(rowsPerStrip, digest.height - first);
+			// asking for just the rows in the strip leaves out any padding on the last one
+			const tmsize_t expected = rowBytes * rows;
+			tmsize_t got = raw ? TIFFReadRawStrip(tif, strip, buffer.data(), expected)
+				: TIFFReadEncodedStrip(tif, strip, buffer.data(), expected);
+			if ( got < expected )
+				return false;
+			crc = crc32c(crc, buffer.data(), expected);
+		}
+	}
+	digest.pixels = crc;
+	return true;
+}
@@ -40,6 +40,7 @@
 //M*/
 
 #include "../include/utils.hpp"
+#include "../include/simd_kernels.h"
 
 #define  SCALE  14
 #define  cR  (int)(0.299*(1 << SCALE) + 0.5)
@@ -50,17 +51,11 @@ void icvCvt_BGR2Gray_8u_C3C1R( const uchar* rgb, int rgb_step,
                                uchar* gray, int gray_step,
                                CvSize size, int _swap_rb )
 {
-    int i;
-    int swap_rb = _swap_rb ? 2 : 0;
+    // the rows are done in simd_kernels.cpp, which uses the same cR, cG and cB
     for( ; size.height--; gray += gray_step )
     {
-        for( i = 0; i < size.width; i++, rgb += 3 )
-        {
-            int t = descale( rgb[swap_rb]*cB + rgb[1]*cG + rgb[swap_rb^2]*cR, SCALE );
-            gray[i] = (uchar)t;
-        }
-
-        rgb += rgb_step - size.width*3;
+        bgrToGray8u( rgb, 3, gray, size.width, _swap_rb != 0 );
+        rgb += rgb_step;
     }
 }
 
@@ -69,17 +64,10 @@ void icvCvt_BGRA2Gray_16u_CnC1R( const ushort* rgb, int rgb_step,
                                 ushort* gray, int gray_step,
                                 CvSize size, int ncn, int _swap_rb )
 {
-    int i;
-    int swap_rb = _swap_rb ? 2 : 0;
     for( ; size.height--; gray += gray_step )
     {
-        for( i = 0; i < size.width; i++, rgb += ncn )
-        {
-            int t = descale( rgb[swap_rb]*cB + rgb[1]*cG + rgb[swap_rb^2]*cR, SCALE );
-            gray[i] = (ushort)t;
-        }
-
-        rgb += rgb_step - size.width*ncn;
+        bgrToGray16u( rgb, ncn, gray, size.width, _swap_rb != 0 );
+        rgb += rgb_step;
     }
 }
 
@@ -88,17 +76,10 @@ void icvCvt_BGRA2Gray_8u_C4C1R( const uchar* rgba, int rgba_step,
                                 uchar* gray, int gray_step,
                                 CvSize size, int _swap_rb )
 {
-    int i;
-    int swap_rb = _swap_rb ? 2 : 0;
     for( ; size.height--; gray += gray_step )
     {
-        for( i = 0; i < size.width; i++, rgba += 4 )
-        {
-            int t = descale( rgba[swap_rb]*cB + rgba[1]*cG + rgba[swap_rb^2]*cR, SCALE );
-            gray[i] = (uchar)t;
-        }
-
-        rgba += rgba_step - size.width*4;
+        bgrToGray8u( rgba, 4, gray, size.width, _swap_rb != 0 );
+        rgba += rgba_step;
     }
 }
 
@@ -121,14 +102,10 @@ void icvCvt_Gray2BGR_8u_C1C3R( const uchar* gray, int gray_step,
 void icvCvt_Gray2BGR_16u_C1C3R( const ushort* gray, int gray_step,
                               ushort* bgr, int bgr_step, CvSize size )
 {
-    int i;
     for( ; size.height--; gray += gray_step/sizeof(gray[0]) )
     {
-        for( i = 0; i < size.width; i++, bgr += 3 )
-        {
-            bgr[0] = bgr[1] = bgr[2] = gray[i];
-        }
-        bgr += bgr_step/sizeof(bgr[0]) - size.width*3;
+        grayToBGR16u( gray, bgr, size.width );
+        bgr += bgr_step/sizeof(bgr[0]);
     }
 }
 
@@ -157,18 +134,11 @@ void icvCvt_BGRA2BGR_16u_C4C3R( const ushort* bgra, int bgra_step,
                               ushort* bgr, int bgr_step,
                               CvSize size, int _swap_rb )
 {
-    int i;
-    int swap_rb = _swap_rb ? 2 : 0;
     for( ; size.height--; )
     {
-        for( i = 0; i < size.width; i++, bgr += 3, bgra += 4 )
-        {
-            ushort t0 = bgra[swap_rb], t1 = bgra[1];
-            bgr[0] = t0; bgr[1] = t1;
-            t0 = bgra[swap_rb^2]; bgr[2] = t0;
-        }
-        bgr += bgr_step/sizeof(bgr[0]) - size.width*3;
-        bgra += bgra_step/sizeof(bgra[0]) - size.width*4;
+        bgraToBGR16u( bgra, bgr, size.width, _swap_rb != 0 );
+        bgr += bgr_step/sizeof(bgr[0]);
+        bgra += bgra_step/sizeof(bgra[0]);
     }
 }
 
@@ -476,11 +446,8 @@ uchar* FillColorRow8( uchar* data, uchar* indices, int len, PaletteEntry* palett
 
 uchar* FillGrayRow8( uchar* data, uchar* indices, int len, uchar* palette )
 {
-    int i;
-    for( i = 0; i < len; i++ )
-    {
-        data[i] = palette[indices[i]];
-    }
+    if( len > 0 )
+        paletteRow8( indices, palette, data, len );
     return data + len;
 }
 
@@ -511,24 +478,9 @@ uchar* FillColorRow4( uchar* data, uchar* indices, int len, PaletteEntry* palett
 
 uchar* FillGrayRow4( uchar* data, uchar* indices, int len, uchar* palette )
 {
-    uchar* end = data + len;
-    while( (data += 2) < end )
-    {
-        int idx = *indices++;
-        data[-2] = palette[idx >> 4];
-        data[-1] = palette[idx & 15];
-    }
-
-    int idx = indices[0];
-    uchar clr = palette[idx >> 4];
-    data[-2] = clr;
-
-    if( data == end )
-    {
-        clr = palette[idx & 15];
-        data[-1] = clr;
-    }
-    return end;
+    if( len > 0 )
+        paletteRow4( indices, palette, data, len );
+    return data + len;
 }
 
 
@@ -562,28 +514,9 @@ uchar* FillColorRow1( uchar* data, uchar* indices, int len, PaletteEntry* palett
 
 uchar* FillGrayRow1( uchar* data, uchar* indices, int len, uchar* palette )
 {
-    uchar* end = data + len;
-
-    while( (data += 8) < end )
-    {
-        int idx = *indices++;
-        *((uchar*)(data - 8)) = palette[(idx & 128) != 0];
-        *((uchar*)(data - 7)) = palette[(idx & 64) != 0];
-        *((uchar*)(data - 6)) = palette[(idx & 32) != 0];
-        *((uchar*)(data - 5)) = palette[(idx & 16) != 0];
-        *((uchar*)(data - 4)) = palette[(idx & 8) != 0];
-        *((uchar*)(data - 3)) = palette[(idx & 4) != 0];
-        *((uchar*)(data - 2)) = palette[(idx & 2) != 0];
-        *((uchar*)(data - 1)) = palette[(idx & 1) != 0];
-    }
-
-    int idx = indices[0] << 24;
-    for( data -= 8; data < end; data++, idx += idx )
-    {
-        data[0] = palette[idx < 0];
-    }
-
-    return data;
+    if( len > 0 )
+        paletteRow1( indices, palette, data, len );
+    return data + len;
 }
 
 
@@ -1,5 +1,8 @@
 #include "../include/write_tiff.h"
 
+#include <fcntl.h>
+#include <unistd.h>
+
 namespace cv
 {
 
@@ -9,6 +12,7 @@ static const char fmtSignTiffMM[] = "MM\x00\x2a";
 BaseImageEncoder::BaseImageEncoder()
 {
 	m_buf_supported = false;
+	m_buf = 0;
 }
 
 bool BaseImageEncoder::isFormatSupported( int depth ) const
@@ -42,14 +46,16 @@ TiffWriter::TiffWriter()
 {
 	m_description = "TIFF Files (*.tiff;*.tif)";
 	m_buf_supported = true;
+	m_tif = NULL;
+	pTiffHandle = NULL;
 }
 
 
 TiffWriter::~TiffWriter()
 {
 	if (opened)
-		TIFFClose(m_tif);
-    if ( pTiffHandle )
+		close();
+    else if ( pTiffHandle )
         TIFFClose(pTiffHandle);
 }
 
@@ -58,6 +64,13 @@ bool TiffWriter::isFormatSupported( int depth ) const
     return depth == CV_8U || depth == CV_16U || depth == CV_32F;
 }
 
+// the horizontal predictor is only understood by these codecs
+static bool usesPredictor(int compression)
+{
+    return compression == COMPRESSION_LZW || compression == COMPRESSION_ADOBE_DEFLATE ||
+           compression == COMPRESSION_DEFLATE;
+}
+
 static void readParam(const std::vector<int>& params, int key, int& value)
 {
     for(size_t i = 0; i + 1 < params.size(); i += 2)
@@ -92,6 +105,11 @@ bool  TiffWriter::writeLibTiff( const cv::Mat& img, const std::vector<int>& para
             bitsPerChannel = 16;
             break;
         }
+        case CV_32F:
+        {
+            bitsPerChannel = 32;
+            break;
+        }
         default:
         {
             return false;
@@ -110,8 +128,10 @@ bool  TiffWriter::writeLibTiff( const cv::Mat& img, const std::vector<int>& para
     // http://www.remotesensing.org/libtiff/man/TIFFOpen.3tiff.html
     // IMPORTANT: Note the "w8" option here - this is what allows writing to the bigTIFF format
     // possible ('normal' tiff would be just "w")
-    if (!(isOpened()))
-    	pTiffHandle = TIFFOpen(m_filename.c_str(), "w8");
+    // if nothing's been opened this is a one-off write to the destination
+    const bool single = !isOpened();
+    if (single)
+    	pTiffHandle = openDestination(m_filename);
     else
     	pTiffHandle = m_tif;
     if (!pTiffHandle)
@@ -125,7 +145,8 @@ bool  TiffWriter::writeLibTiff( const cv::Mat& img, const std::vector<int>& para
     int    units        = RESUNIT_INCH;
     double xres         = 72.0;
     double yres         = 72.0;
-    int    sampleformat = SAMPLEFORMAT_INT;
+    int    sampleformat = depth == CV_16S ? SAMPLEFORMAT_INT :
+                          depth == CV_32F ? SAMPLEFORMAT_IEEEFP : SAMPLEFORMAT_UINT;
     int    orientation  = ORIENTATION_TOPLEFT;
     int planarConfig = 1;
 
@@ -151,13 +172,17 @@ bool  TiffWriter::writeLibTiff( const cv::Mat& img, const std::vector<int>& para
       || !TIFFSetField(pTiffHandle, TIFFTAG_ORIENTATION, orientation)
        )
     {
-        TIFFClose(pTiffHandle);
+        if ( pTiffHandle != m_tif )
+            TIFFClose(pTiffHandle);
+        pTiffHandle = NULL;
         return false;
     }
 
-    if (compression != COMPRESSION_NONE && !TIFFSetField(pTiffHandle, TIFFTAG_PREDICTOR, predictor) )
+    if (usesPredictor(compression) && !TIFFSetField(pTiffHandle, TIFFTAG_PREDICTOR, predictor) )
     {
-        TIFFClose(pTiffHandle);
+        if ( pTiffHandle != m_tif )
+            TIFFClose(pTiffHandle);
+        pTiffHandle = NULL;
         return false;
     }
 
@@ -170,7 +195,9 @@ bool  TiffWriter::writeLibTiff( const cv::Mat& img, const std::vector<int>& para
     uint64 * buffer16 = (uint64*)buffer;//unsigned int16
     if (!buffer)
     {
-        TIFFClose(pTiffHandle);
+        if ( pTiffHandle != m_tif )
+            TIFFClose(pTiffHandle);
+        pTiffHandle = NULL;
         return false;
     }
 
@@ -180,14 +207,35 @@ bool  TiffWriter::writeLibTiff( const cv::Mat& img, const std::vector<int>& para
         int writeResult = TIFFWriteScanline(pTiffHandle, buffer16, y, 0);
         if (writeResult != 1)
         {
-            TIFFClose(pTiffHandle);
+            if ( pTiffHandle != m_tif )
+                TIFFClose(pTiffHandle);
+            pTiffHandle = NULL;
             return false;
         }
     }
     ++frame_number;
     time_stamp += 1/30.0;
-    TIFFWriteDirectory(pTiffHandle); // write into the next directory
-    return true;
+    /*
+    From 4.5 (see ScanImageTiff.h) libtiff links in the next directory
+    through the last one it wrote rather than walking the chain from the
+    header, so a sink that can't seek can let go of everything before the
+    previous frame
+    */
+    const uint64 frameStart = m_sink ? m_sink->size() : 0;
+    bool written = TIFFWriteDirectory(pTiffHandle); // write into the next directory
+    if ( m_sink )
+    {
+        m_sink->commit(m_lastFrameStart);
+        m_lastFrameStart = frameStart;
+    }
+    ++m_dirsWritten;
+    if (single)
+    {
+        TIFFClose(pTiffHandle);
+        m_sink.reset();
+        pTiffHandle = NULL;
+    }
+    return written;
 }
 
 bool TiffWriter::writeHdr(const cv::Mat& _img)
@@ -197,7 +245,7 @@ bool TiffWriter::writeHdr(const cv::Mat& _img)
     // IMPORTANT: Note the "w8" option here - this is what allows writing to the bigTIFF format
     // possible ('normal' tiff would be just "w")
     if (!(isOpened()))
-    	m_tif = TIFFOpen(m_filename.c_str(), "w8");
+    	m_tif = openDestination(m_filename);
     if (!m_tif)
     {
         return false;
@@ -230,8 +278,9 @@ void TiffWriter::writeTag( WLByteStream& strm, TiffTag tag,
 }
 
 bool TiffWriter::writeSIHdr(const std::string swTag, const std::string imDescTag) {
-    auto _swTag = swTag.c_str();
-    auto _imDescTag = imDescTag.c_str();
+    // ImageDescription first as that's the order the entries end up in the IFD
+    auto _imDescTag = shareTag(TIFFTAG_IMAGEDESCRIPTION, imDescTag);
+    auto _swTag = shareTag(TIFFTAG_SOFTWARE, swTag);
     if ( ( TIFFSetField(m_tif, TIFFTAG_IMAGEDESCRIPTION, _imDescTag) > 0 ) &&
         ( TIFFSetField(m_tif, TIFFTAG_SOFTWARE, _swTag) > 0 ) )
         return true;
@@ -247,7 +296,7 @@ bool TiffWriter::write( const cv::Mat& img, const std::vector<int>& params)
     {
         return writeHdr(img);
     }
-    if (depth != CV_8U && depth != CV_16U && depth != CV_16S)
+    if (depth != CV_8U && depth != CV_16U && depth != CV_16S && depth != CV_32F)
         return false;
     return writeLibTiff(img, params);
 }
@@ -260,23 +309,426 @@ bool TiffWriter::isOpened()
 		return false;
 }
 
-bool TiffWriter::open(cv::String outputPath)
+bool TiffWriter::open(cv::String outputPath, bool bigtiff)
+{
+	if (!(opened))
+	{
+		m_bigtiff = bigtiff;
+		m_streamfd = -1;
+		setDestination(outputPath);
+		m_tif = openDestination(outputPath);
+		opened = m_tif != NULL;
+	}
+	return opened;
+}
+
+bool TiffWriter::open(std::vector<uchar> & buf, bool bigtiff)
+{
+	if (!(opened))
+	{
+		m_bigtiff = bigtiff;
+		m_streamfd = -1;
+		setDestination(buf);
+		m_tif = openDestination("memory");
+		opened = m_tif != NULL;
+	}
+	return opened;
+}
+
+bool TiffWriter::openStream(int fd, bool bigtiff)
 {
 	if (!(opened))
 	{
-        // IMPORTANT: Note the "w8" option here - this is what allows writing to the bigTIFF format
-        // possible ('normal' tiff would be just "w")
-		m_tif = TIFFOpen(outputPath.c_str(), "w8");
-		m_filename = outputPath;
-		opened = true;
+		m_bigtiff = bigtiff;
+		m_streamfd = fd;
+		setDestination("stream");
+		m_tif = openDestination("stream");
+		opened = m_tif != NULL;
 	}
+	return opened;
+}
+
+TIFF * TiffWriter::openDestination(const cv::String & name)
+{
+    m_sharedTags.clear();
+    m_lastImDesc.clear();
+    m_lastSw.clear();
+    m_dirsWritten = 0;
+    m_lastFrameStart = 0;
+    // IMPORTANT: Note the "w8" option here - this is what allows writing to the bigTIFF format
+    // possible ('normal' tiff would be just "w")
+    const char * mode = m_bigtiff ? "w8" : "w";
+    if ( m_buf )
+    {
+        MemorySink * sink = new MemorySink(*m_buf);
+        m_sink.reset(sink);
+        return sink->openTiff(name, mode);
+    }
+    if ( m_streamfd >= 0 )
+    {
+        StreamSink * sink = new StreamSink(m_streamfd);
+        m_sink.reset(sink);
+        return sink->openTiff(name, mode);
+    }
+    if ( m_directio )
+    {
+        DirectFileSink * sink = new DirectFileSink();
+        m_sink.reset(sink);
+        return sink->open(name) ? sink->openTiff(name, mode) : NULL;
+    }
+    m_sink.reset();
+    return TIFFOpen(name.c_str(), mode);
+}
+
+bool TiffWriter::reserve(uint64 bytes)
+{
+    // a memory buffer can just grow its capacity up front
+    if ( opened && m_sink && m_sink->reserve(bytes) )
+        return true;
+#ifdef __linux__
+    if ( opened && bytes > 0 )
+    {
+        int fd = fileDescriptor();
+        if ( fd >= 0 && fallocate(fd, FALLOC_FL_KEEP_SIZE, 0, (off_t)bytes) == 0 )
+        {
+            m_reserved = bytes;
+            return true;
+        }
+    }
+#endif
+    return false;
+}
+
+int TiffWriter::fileDescriptor()
+{
+    if ( m_sink )
+        return m_sink->fileno();
+    return m_tif ? TIFFFileno(m_tif) : -1;
+}
+
+void TiffWriter::releaseReservation()
+{
+#ifdef __linux__
+    if ( opened && m_reserved )
+    {
+        // get the final directory out first so end-of-file is where it'll stay
+        TIFFFlush(m_tif);
+        int fd = fileDescriptor();
+        off_t end = m_sink ? (off_t)m_sink->size() : lseek(fd, 0, SEEK_END);
+        // the spare blocks are all past end-of-file, where punching a hole does nothing,
+        // but truncating frees them (as DirectFileSink::close does)
+        if ( end >= 0 && (uint64)end < m_reserved && ftruncate(fd, end) != 0 )
+            std::cout << "Failed to hand back the space reserved for " << m_filename << std::endl;
+    }
+#endif
+    m_reserved = 0;
+}
+
+/*
+The most a strip of rows x rowBytes can come out as once compressed. The
+frame is a single strip (see writeLibTiff)
+*/
+static uint64 compressedBound(int compression, uint64 rows, uint64 rowBytes)
+{
+    const uint64 bytes = rows * rowBytes;
+    switch ( compression )
+    {
+        case COMPRESSION_NONE:
+            return bytes;
+        case COMPRESSION_PACKBITS:
+            // libtiff packs each row on its own, a literal run header every 128 bytes
+            return bytes + rows * ((rowBytes + 127) / 128);
+        case COMPRESSION_ADOBE_DEFLATE:
+        case COMPRESSION_DEFLATE:
+            // zlib's stored blocks: 0.1% plus 12 bytes, and the 6 byte zlib wrapper
+            return bytes + bytes / 1000 + 18;
+        default:
+            /*
+            LZW: every code stands for at least one byte and is at most 12
+            bits, plus a clear code each time the table fills (every 3838
+            codes or so) or the ratio check restarts it (every 10000 bytes
+            at most), and the first clear and the end-of-information code.
+            Used for anything else too, none of which is written by a split
+            */
+            return bytes + bytes / 2 + bytes / 500 + 8;
+    }
+}
+
+uint64 TiffWriter::estimateFrameBytes(int width, int height, int bitsPerSample, int channels,
+                                      size_t imDescLen, size_t swLen, bool bigtiff,
+                                      int compression)
+{
+    // tags set by writeLibTiff() and writeSIHdr()
+    const uint64 ntags = usesPredictor(compression) ? 18 : 17;
+    const uint64 entrySize = bigtiff ? 20 : 12;
+    const uint64 inlineSize = bigtiff ? 8 : 4;
+
+    uint64 bytes = compressedBound(compression, height, (uint64)width * channels * ((bitsPerSample + 7) / 8));
+    // entry count + entries + next IFD offset, +1 as libtiff word-aligns the IFD
+    bytes += (bigtiff ? 8 : 2) + ntags * entrySize + (bigtiff ? 8 : 4) + 1;
+    // ASCII counts include the NUL; anything too big for the entry is stored
+    // after the IFD, again word-aligned
+    const uint64 strings[2] = { imDescLen + 1, swLen + 1 };
+    for ( uint64 len : strings )
+        if ( len > inlineSize )
+            bytes += len + (len & 1);
+    // X and Y resolution are RATIONALs which only fit inline in a BigTIFF
+    if ( !bigtiff )
+        bytes += 2 * 8;
+    return bytes;
+}
+
+// copies a single valued tag from one directory to another if it's there
+template <typename T>
+static bool copyField(TIFF * src, TIFF * dst, uint32 tag)
+{
+    T value;
+    if ( TIFFGetField(src, tag, &value) != 1 )
+        return true;
+    return TIFFSetField(dst, tag, value) == 1;
+}
+
+// the strips of these can be copied as they are
+static bool rawCopyable(uint16 compression, uint16 photometric)
+{
+    if ( photometric == PHOTOMETRIC_YCBCR )
+        return false;
+    switch ( compression )
+    {
+        case COMPRESSION_NONE:
+        case COMPRESSION_LZW:
+        case COMPRESSION_ADOBE_DEFLATE:
+        case COMPRESSION_DEFLATE:
+        case COMPRESSION_PACKBITS:
+        case COMPRESSION_LZMA:
+        case COMPRESSION_ZSTD:
+            return TIFFIsCODECConfigured(compression) == 1;
+        default:
+            return false;
+    }
+}
+
+bool TiffWriter::copyDirectory(TIFF * src)
+{
+    if ( !opened || !src )
+        return false;
+    uint16 compression = COMPRESSION_NONE, photometric = PHOTOMETRIC_MINISBLACK;
+    TIFFGetField(src, TIFFTAG_COMPRESSION, &compression);
+    TIFFGetField(src, TIFFTAG_PHOTOMETRIC, &photometric);
+    // raw strips keep the source's byte order, so samples wider than a byte from a file in the
+    // other order have to be decoded (libtiff swaps them on the way in and out)
+    uint16 bitsPerSample = 1;
+    TIFFGetFieldDefaulted(src, TIFFTAG_BITSPERSAMPLE, &bitsPerSample);
+    const bool swapped = bitsPerSample > 8 && TIFFIsByteSwapped(src) != TIFFIsByteSwapped(m_tif);
+    const bool raw = rawCopyable(compression, photometric) && !swapped;
+    const bool tiled = TIFFIsTiled(src) != 0;
+
+    bool ok = copyField<uint32>(src, m_tif, TIFFTAG_IMAGEWIDTH)
+           && copyField<uint32>(src, m_tif, TIFFTAG_IMAGELENGTH)
+           && copyField<uint16>(src, m_tif, TIFFTAG_BITSPERSAMPLE)
+           && copyField<uint16>(src, m_tif, TIFFTAG_SAMPLESPERPIXEL)
+           && copyField<uint16>(src, m_tif, TIFFTAG_PHOTOMETRIC)
+           && copyField<uint16>(src, m_tif, TIFFTAG_PLANARCONFIG)
+           && copyField<uint16>(src, m_tif, TIFFTAG_SAMPLEFORMAT)
+           && copyField<uint16>(src, m_tif, TIFFTAG_ORIENTATION)
+           && copyField<uint16>(src, m_tif, TIFFTAG_FILLORDER)
+           && copyField<uint16>(src, m_tif, TIFFTAG_RESOLUTIONUNIT)
+           && copyField<float>(src, m_tif, TIFFTAG_XRESOLUTION)
+           && copyField<float>(src, m_tif, TIFFTAG_YRESOLUTION);
+    if ( tiled )
+        ok = ok && copyField<uint32>(src, m_tif, TIFFTAG_TILEWIDTH)
+                && copyField<uint32>(src, m_tif, TIFFTAG_TILELENGTH);
+    else
+        ok = ok && copyField<uint32>(src, m_tif, TIFFTAG_ROWSPERSTRIP);
+    // the predictor belongs to the codec so has to come after the compression
+    if ( raw )
+        ok = ok && TIFFSetField(m_tif, TIFFTAG_COMPRESSION, compression) == 1
+                && ( !usesPredictor(compression) || copyField<uint16>(src, m_tif, TIFFTAG_PREDICTOR) );
+    else
+        ok = ok && TIFFSetField(m_tif, TIFFTAG_COMPRESSION, COMPRESSION_NONE) == 1;
+    uint16 nextra;
+    uint16 * extra;
+    if ( TIFFGetField(src, TIFFTAG_EXTRASAMPLES, &nextra, &extra) == 1 )
+        ok = ok && TIFFSetField(m_tif, TIFFTAG_EXTRASAMPLES, nextra, extra) == 1;
+    char * tag;
+    if ( TIFFGetField(src, TIFFTAG_DATETIME, &tag) == 1 )
+        ok = ok && TIFFSetField(m_tif, TIFFTAG_DATETIME, tag) == 1;
+    // the ScanImage tags go through the same sharing as writeSIHdr
+    if ( TIFFGetField(src, TIFFTAG_IMAGEDESCRIPTION, &tag) == 1 )
+    {
+        std::string imDesc(tag);
+        ok = ok && TIFFSetField(m_tif, TIFFTAG_IMAGEDESCRIPTION, shareTag(TIFFTAG_IMAGEDESCRIPTION, imDesc)) == 1;
+    }
+    if ( TIFFGetField(src, TIFFTAG_SOFTWARE, &tag) == 1 )
+    {
+        std::string sw(tag);
+        ok = ok && TIFFSetField(m_tif, TIFFTAG_SOFTWARE, shareTag(TIFFTAG_SOFTWARE, sw)) == 1;
+    }
+    if ( !ok )
+        return false;
+
+    const uint32 nchunks = tiled ? TIFFNumberOfTiles(src) : TIFFNumberOfStrips(src);
+    for ( uint32 i = 0; i < nchunks; ++i )
+    {
+        tmsize_t n;
+        if ( raw )
+        {
+            // TIFFGetStrileByteCount (4.1) and ZSTD above (4.0) are well within the 4.5 floor
+            uint64 size = TIFFGetStrileByteCount(src, i);
+            m_stripBuffer.resize(size);
+            n = tiled ? TIFFReadRawTile(src, i, m_stripBuffer.data(), size)
+                      : TIFFReadRawStrip(src, i, m_stripBuffer.data(), size);
+            if ( n < 0 )
+                return false;
+            n = tiled ? TIFFWriteRawTile(m_tif, i, m_stripBuffer.data(), n)
+                      : TIFFWriteRawStrip(m_tif, i, m_stripBuffer.data(), n);
+        }
+        else
+        {
+            m_stripBuffer.resize(tiled ? TIFFTileSize(src) : TIFFStripSize(src));
+            n = tiled ? TIFFReadEncodedTile(src, i, m_stripBuffer.data(), m_stripBuffer.size())
+                      : TIFFReadEncodedStrip(src, i, m_stripBuffer.data(), m_stripBuffer.size());
+            if ( n < 0 )
+                return false;
+            n = tiled ? TIFFWriteEncodedTile(m_tif, i, m_stripBuffer.data(), n)
+                      : TIFFWriteEncodedStrip(m_tif, i, m_stripBuffer.data(), n);
+        }
+        if ( n < 0 )
+            return false;
+    }
+    if ( TIFFWriteDirectory(m_tif) != 1 )
+        return false;
+    ++m_dirsWritten;
+    return true;
+}
+
+// Returns what should actually go in the tag - the value or an empty placeholder
+const char * TiffWriter::shareTag(uint16 tag, const std::string & value)
+{
+    // values that fit in the IFD entry itself gain nothing from sharing
+    const size_t inlineSize = m_bigtiff ? 8 : 4;
+    // patching the placeholders means going back over the whole file, which a stream can't do
+    if ( m_shareTags && m_streamfd < 0 && value.size() + 1 > inlineSize )
+    {
+        uint16 source = 0;
+        if ( value == m_lastImDesc )
+            source = TIFFTAG_IMAGEDESCRIPTION;
+        else if ( value == m_lastSw )
+            source = TIFFTAG_SOFTWARE;
+        if ( source )
+        {
+            m_sharedTags.push_back({m_dirsWritten, tag, source});
+            return "";
+        }
+    }
+    (tag == TIFFTAG_IMAGEDESCRIPTION ? m_lastImDesc : m_lastSw) = value;
+    return value.c_str();
+}
+
+/*
+Walks the IFDs that have been written, remembering where the last full
+value of each tag went, and copies its count and offset into the
+placeholder entries. Goes through libtiff's own I/O procs so it works
+whatever the file is sitting on (see TiffSink). Nothing changes size so
+only the entries themselves are rewritten
+*/
+bool TiffWriter::patchSharedTags()
+{
+    if ( m_sharedTags.empty() )
+        return true;
+    TIFFFlush(m_tif);
+    thandle_t handle = TIFFClientdata(m_tif);
+    TIFFReadWriteProc readProc = TIFFGetReadProc(m_tif);
+    TIFFReadWriteProc writeProc = TIFFGetWriteProc(m_tif);
+    TIFFSeekProc seekProc = TIFFGetSeekProc(m_tif);
+    const bool swab = TIFFIsByteSwapped(m_tif);
+    const size_t countSize = m_bigtiff ? 8 : 2;
+    const size_t entrySize = m_bigtiff ? 20 : 12;
+    const size_t offsetSize = m_bigtiff ? 8 : 4;
+    // the count and value/offset fields of an entry, copied as they are
+    const size_t valueSize = entrySize - 4;
+
+    auto readAt = [&](uint64 pos, void * buf, size_t len)
+    {
+        return seekProc(handle, pos, SEEK_SET) == pos && readProc(handle, buf, len) == (tmsize_t)len;
+    };
+    auto get = [&](const uchar * p, size_t len) -> uint64
+    {
+        uint16 v16; uint32 v32; uint64 v64;
+        switch ( len )
+        {
+            case 2: memcpy(&v16, p, 2); if ( swab ) TIFFSwabShort(&v16); return v16;
+            case 4: memcpy(&v32, p, 4); if ( swab ) TIFFSwabLong(&v32); return v32;
+            default: memcpy(&v64, p, 8); if ( swab ) TIFFSwabLong8(&v64); return v64;
+        }
+    };
+
+    uchar header[16];
+    if ( !readAt(0, header, headerBytes(m_bigtiff)) )
+        return false;
+    uint64 diroff = get(header + (m_bigtiff ? 8 : 4), offsetSize);
+    uchar lastFull[2][16]; // [0] ImageDescription, [1] Software
+    bool haveFull[2] = { false, false };
+    std::vector<uchar> ifd;
+    size_t next = 0;
+    for ( uint32 dir = 0; diroff != 0 && next < m_sharedTags.size(); ++dir )
+    {
+        uchar countBuf[8];
+        if ( !readAt(diroff, countBuf, countSize) )
+            return false;
+        uint64 nentries = get(countBuf, countSize);
+        ifd.resize(nentries * entrySize + offsetSize);
+        if ( readProc(handle, ifd.data(), ifd.size()) != (tmsize_t)ifd.size() )
+            return false;
+        bool dirty = false;
+        for ( uint64 i = 0; i < nentries; ++i )
+        {
+            uchar * entry = &ifd[i * entrySize];
+            uint16 tag = (uint16)get(entry, 2);
+            if ( tag != TIFFTAG_IMAGEDESCRIPTION && tag != TIFFTAG_SOFTWARE )
+                continue;
+            if ( next < m_sharedTags.size() && m_sharedTags[next].dir == dir && m_sharedTags[next].tag == tag )
+            {
+                int source = m_sharedTags[next].source == TIFFTAG_IMAGEDESCRIPTION ? 0 : 1;
+                if ( !haveFull[source] )
+                    return false;
+                memcpy(entry + 4, lastFull[source], valueSize);
+                dirty = true;
+                ++next;
+            }
+            else
+            {
+                int slot = tag == TIFFTAG_IMAGEDESCRIPTION ? 0 : 1;
+                memcpy(lastFull[slot], entry + 4, valueSize);
+                haveFull[slot] = true;
+            }
+        }
+        if ( dirty )
+        {
+            const size_t len = nentries * entrySize;
+            if ( seekProc(handle, diroff + countSize, SEEK_SET) != diroff + countSize ||
+                 writeProc(handle, ifd.data(), len) != (tmsize_t)len )
+                return false;
+        }
+        diroff = get(&ifd[nentries * entrySize], offsetSize);
+    }
+    return next == m_sharedTags.size();
 }
 
 bool TiffWriter::close() {
     if ( opened ) {
+        bool ok = patchSharedTags();
+        if ( !ok )
+            std::cout << "Failed to fill in the shared tags in " << m_filename << std::endl;
+        releaseReservation();
         TIFFClose(m_tif);
+        m_sink.reset();
+        m_tif = NULL;
+        pTiffHandle = NULL;
         opened = false;
+        return ok;
     }
+    return false;
 }
 
 TiffWriter& TiffWriter::operator << (cv::Mat& frame)
@@ -286,6 +738,7 @@ TiffWriter& TiffWriter::operator << (cv::Mat& frame)
 		std::vector<int> params;
 		write(frame, params);
 	}
+	return *this;
 }
 std::string TiffWriter::type2str(int type)
 {